@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+Runs the programs `make runbench` builds from the kernels in bench/ and measures
+them with hardware counters, or compares two of its reports. Executables are named
+<kernel>-<setting>, e.g. bin/bench/fib-O2, and every setting of a kernel has to
+print the same output.
+
+    runbench [-runs=<n>] -o <report.json> <executable>...
+    runbench [-threshold=<percent>] -compare <baseline.json> <report.json>
+*/
+
+#define DEFAULT_RUNS 5
+#define DEFAULT_THRESHOLD 5.0
+
+//  ┌――――――――――┐  //
+//  │ Counters │  //
+// └――――――――――┘   //
+
+enum Counter {
+    CYCLES, INSTRUCTIONS, BRANCH_MISSES, COUNTERS
+};
+
+static const char *counter_names[COUNTERS] = {"cycles", "instructions", "branch_misses"};
+static const uint64_t counter_configs[COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// user space only, which `perf_event_paranoid` up to 2 allows for our own children
+static int open_counter(pid_t pid, Counter counter, int group) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counter_configs[counter];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // the whole group starts counting when the child calls exec
+    if(group == -1) {
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+    }
+    return syscall(SYS_perf_event_open, &attr, pid, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// the count, scaled up if the counter was multiplexed with others
+static double read_counter(int fd) {
+    uint64_t values[3];
+    if(read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+        return NAN;
+    }
+    return (double) values[0] * values[1] / values[2];
+}
+
+//  ┌―――――――――┐  //
+//  │ Running │  //
+// └―――――――――┘   //
+
+// one run of a program, NAN for counters that could not be opened
+struct Sample {
+    double wall_ms;
+    double counters[COUNTERS];
+    std::string output;
+};
+
+static bool warned_counters = false;
+
+static Sample run_once(const std::string &path) {
+    // the child waits for the counters to be attached before it execs
+    int go[2];
+    if(pipe(go) != 0) {
+        perror("Error: pipe");
+        exit(1);
+    }
+    FILE *output = tmpfile();
+    if(!output) {
+        perror("Error: tmpfile");
+        exit(1);
+    }
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        perror("Error: fork");
+        exit(1);
+    }
+    if(pid == 0) {
+        close(go[1]);
+        char c;
+        if(read(go[0], &c, 1) < 0) {
+            _exit(127);
+        }
+        dup2(fileno(output), STDOUT_FILENO);
+        execl(path.c_str(), path.c_str(), (char*) nullptr);
+        perror(("Error: " + path).c_str());
+        _exit(127);
+    }
+    close(go[0]);
+
+    Sample sample;
+    int fds[COUNTERS];
+    for(int i = 0; i < COUNTERS; i++) {
+        fds[i] = open_counter(pid, (Counter) i, i == 0 ? -1 : fds[0]);
+    }
+    if(fds[0] < 0 && !warned_counters) {
+        std::cerr << "Warning: perf_event_open failed (" << strerror(errno)
+            << "), only the wall time is measured" << std::endl;
+        warned_counters = true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    close(go[1]);
+    int status;
+    waitpid(pid, &status, 0);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    sample.wall_ms = elapsed.count();
+
+    for(int i = 0; i < COUNTERS; i++) {
+        sample.counters[i] = fds[i] < 0 ? NAN : read_counter(fds[i]);
+        if(fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+
+    if(!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        std::cerr << "Error: " << path << " did not run to completion" << std::endl;
+        exit(1);
+    }
+    rewind(output);
+    char chunk[4096];
+    size_t read_bytes;
+    while((read_bytes = fread(chunk, 1, sizeof(chunk), output)) > 0) {
+        sample.output.append(chunk, read_bytes);
+    }
+    fclose(output);
+    return sample;
+}
+
+// of the values that are not NAN, NAN if there are none
+static double median(std::vector<double> values) {
+    values.erase(std::remove_if(values.begin(), values.end(), [](double value) { return std::isnan(value); }), values.end());
+    if(values.empty()) {
+        return NAN;
+    }
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// medians over all runs of one executable
+struct Result {
+    std::string kernel;
+    std::string setting;
+    double wall_ms;
+    double counters[COUNTERS];
+};
+
+static Result measure(const std::string &path, int runs, std::map<std::string, std::string> &outputs) {
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    size_t dash = name.find_last_of('-');
+    if(dash == std::string::npos) {
+        std::cerr << "Error: " << path << " is not named <kernel>-<setting>" << std::endl;
+        exit(1);
+    }
+    Result result;
+    result.kernel = name.substr(0, dash);
+    result.setting = name.substr(dash + 1);
+
+    // warms up the page cache, and is the output the other settings must match
+    Sample first = run_once(path);
+    auto expected = outputs.find(result.kernel);
+    if(expected == outputs.end()) {
+        outputs[result.kernel] = first.output;
+    } else if(expected->second != first.output) {
+        std::cerr << "Error: " << path << " prints something else than the other settings of " << result.kernel << std::endl;
+        exit(1);
+    }
+
+    std::vector<double> wall;
+    std::vector<double> counters[COUNTERS];
+    for(int i = 0; i < runs; i++) {
+        Sample sample = run_once(path);
+        wall.push_back(sample.wall_ms);
+        for(int j = 0; j < COUNTERS; j++) {
+            counters[j].push_back(sample.counters[j]);
+        }
+    }
+    result.wall_ms = median(wall);
+    for(int j = 0; j < COUNTERS; j++) {
+        result.counters[j] = median(counters[j]);
+    }
+    return result;
+}
+
+//  ┌――――――――┐  //
+//  │ Report │  //
+// └――――――――┘   //
+
+static std::string json_number(double value) {
+    if(std::isnan(value)) {
+        return "null";
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    return buffer;
+}
+
+// one result per line, which is all `read_report` understands
+static void write_report(const std::string &file, int runs, const std::vector<Result> &results) {
+    std::ofstream out(file);
+    if(!out) {
+        std::cerr << "Error: could not write " << file << std::endl;
+        exit(1);
+    }
+    out << "{\n";
+    out << "  \"runs\": " << runs << ",\n";
+    out << "  \"results\": [\n";
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        out << "    {\"kernel\": \"" << result.kernel << "\", \"setting\": \"" << result.setting << "\"";
+        out << ", \"wall_ms\": " << json_number(result.wall_ms);
+        for(int j = 0; j < COUNTERS; j++) {
+            out << ", \"" << counter_names[j] << "\": " << json_number(result.counters[j]);
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+static std::string string_field(const std::string &line, const std::string &key) {
+    std::string pattern = "\"" + key + "\": \"";
+    size_t start = line.find(pattern);
+    if(start == std::string::npos) {
+        return "";
+    }
+    start += pattern.size();
+    return line.substr(start, line.find('"', start) - start);
+}
+
+static double number_field(const std::string &line, const std::string &key) {
+    std::string pattern = "\"" + key + "\": ";
+    size_t start = line.find(pattern);
+    if(start == std::string::npos || line.compare(start + pattern.size(), 4, "null") == 0) {
+        return NAN;
+    }
+    return strtod(line.c_str() + start + pattern.size(), nullptr);
+}
+
+static std::vector<Result> read_report(const std::string &file) {
+    std::ifstream in(file);
+    if(!in) {
+        std::cerr << "Error: could not read " << file << std::endl;
+        exit(1);
+    }
+    std::vector<Result> results;
+    std::string line;
+    while(getline(in, line)) {
+        if(line.find("\"kernel\"") == std::string::npos) {
+            continue;
+        }
+        Result result;
+        result.kernel = string_field(line, "kernel");
+        result.setting = string_field(line, "setting");
+        result.wall_ms = number_field(line, "wall_ms");
+        for(int j = 0; j < COUNTERS; j++) {
+            result.counters[j] = number_field(line, counter_names[j]);
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+//  ┌――――――――――――┐  //
+//  │ Comparison │  //
+// └――――――――――――┘   //
+
+static std::string change(double before, double after) {
+    if(std::isnan(before) || std::isnan(after) || before == 0) {
+        return "-";
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%+.1f%%", (after - before) / before * 100);
+    return buffer;
+}
+
+/*
+Prints the change of every metric. A result regresses when its cycles or
+instructions grow by more than `threshold` percent, or its wall time when there
+are no counters, since wall time alone is too noisy to judge small changes.
+*/
+static int compare(const std::string &baseline_file, const std::string &report_file, double threshold) {
+    std::vector<Result> baseline = read_report(baseline_file);
+    std::vector<Result> report = read_report(report_file);
+
+    printf("%-12s %-8s %12s %12s %14s %14s\n", "kernel", "setting", "wall", "cycles", "instructions", "branch misses");
+    int regressions = 0;
+    for(auto &after : report) {
+        auto before = std::find_if(baseline.begin(), baseline.end(), [&](const Result &result) {
+            return result.kernel == after.kernel && result.setting == after.setting;
+        });
+        if(before == baseline.end()) {
+            printf("%-12s %-8s %12s\n", after.kernel.c_str(), after.setting.c_str(), "new");
+            continue;
+        }
+
+        bool counted = !std::isnan(before->counters[CYCLES]) && !std::isnan(after.counters[CYCLES]);
+        bool regressed = false;
+        auto worse = [&](double a, double b) { return !std::isnan(a) && !std::isnan(b) && b > a * (1 + threshold / 100); };
+        if(counted) {
+            regressed = worse(before->counters[CYCLES], after.counters[CYCLES])
+                || worse(before->counters[INSTRUCTIONS], after.counters[INSTRUCTIONS]);
+        } else {
+            regressed = worse(before->wall_ms, after.wall_ms);
+        }
+        regressions += regressed;
+
+        printf("%-12s %-8s %12s %12s %14s %14s%s\n", after.kernel.c_str(), after.setting.c_str(),
+            change(before->wall_ms, after.wall_ms).c_str(),
+            change(before->counters[CYCLES], after.counters[CYCLES]).c_str(),
+            change(before->counters[INSTRUCTIONS], after.counters[INSTRUCTIONS]).c_str(),
+            change(before->counters[BRANCH_MISSES], after.counters[BRANCH_MISSES]).c_str(),
+            regressed ? "  regressed" : "");
+    }
+    if(regressions) {
+        printf("%d regressed by more than %.1f%%\n", regressions, threshold);
+    }
+    return regressions ? 1 : 0;
+}
+
+static void usage() {
+    std::cerr << "Usage:\n";
+    std::cerr << "\t`runbench [-runs=<n>] -o <report.json> <executable>...`, runs each executable <n> times (default "
+        << DEFAULT_RUNS << ") and writes the medians\n";
+    std::cerr << "\t`runbench [-threshold=<percent>] -compare <baseline.json> <report.json>`, prints the changes, "
+        << "fails if cycles or instructions grew by more than <percent> (default " << DEFAULT_THRESHOLD << ")\n";
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int runs = DEFAULT_RUNS;
+    double threshold = DEFAULT_THRESHOLD;
+    std::string output;
+    std::vector<std::string> files;
+    bool comparing = false;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if(arg.compare(0, 6, "-runs=") == 0) {
+            runs = atoi(arg.c_str() + 6);
+        } else if(arg.compare(0, 11, "-threshold=") == 0) {
+            threshold = atof(arg.c_str() + 11);
+        } else if(arg == "-o" && i + 1 < argc) {
+            output = argv[++i];
+        } else if(arg == "-compare") {
+            comparing = true;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if(comparing) {
+        if(files.size() != 2) {
+            usage();
+        }
+        return compare(files[0], files[1], threshold);
+    }
+    if(output.empty() || files.empty() || runs <= 0) {
+        usage();
+    }
+
+    std::vector<Result> results;
+    std::map<std::string, std::string> outputs;
+    for(auto &file : files) {
+        Result result = measure(file, runs, outputs);
+        printf("%-12s %-8s %10.2f ms", result.kernel.c_str(), result.setting.c_str(), result.wall_ms);
+        if(!std::isnan(result.counters[CYCLES])) {
+            printf(" %14.0f cycles %14.0f instructions %12.0f branch misses",
+                result.counters[CYCLES], result.counters[INSTRUCTIONS], result.counters[BRANCH_MISSES]);
+        }
+        printf("\n");
+        results.push_back(result);
+    }
+    write_report(output, runs, results);
+    return 0;
+}
@@ -6,17 +6,23 @@
 #include <vector>
 
 struct LLVMCompiler;
+struct Visitor;
 
 /**
 Base node class. Defined as `abstract`.
 */
 struct Node {
     enum NodeType {
-        BIN_OP, INT_LIT, STMTS, ASSN, DBG, IDENT
+        BIN_OP, INT_LIT, STMTS, ASSN, DBG, IDENT,
+        ARG, ARGS, PARAMS, FUNC, CALL, RET, IF, PAR
     } type;
 
-    virtual std::string to_string() = 0;
+    virtual ~Node() {}
+    virtual void accept(Visitor &visitor) = 0;
     virtual llvm::Value *llvm_codegen(LLVMCompiler *compiler) = 0;
+
+    // S-expression of the node, as printed by `-p`
+    std::string to_string();
 };
 
 /**
@@ -27,7 +33,7 @@ struct NodeStmts : public Node {
 
     NodeStmts();
     void push_back(Node *node);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -36,7 +42,7 @@ struct NodeArg : public Node {
     std::string dtype;
 
     NodeArg(std::string id, std::string d);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 struct NodeArgs : public Node {
@@ -44,7 +50,7 @@ struct NodeArgs : public Node {
 
     NodeArgs();
     void push_back(NodeArg *node);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -53,7 +59,7 @@ struct NodeParams : public Node {
 
     NodeParams();
     void push_back(Node *node);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -68,7 +74,7 @@ struct NodeBinOp : public Node {
     Node *left, *right;
 
     NodeBinOp(Op op, Node *leftptr, Node *rightptr);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -77,9 +83,11 @@ struct NodeBinOp : public Node {
 */
 struct NodeInt : public Node {
     long long value;
+    // type the literal is generated with, picked from the value when empty
+    std::string dtype;
 
-    NodeInt(long long val);
-    std::string to_string();
+    NodeInt(long long val, std::string d = "");
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -92,7 +100,7 @@ struct NodeDecl : public Node {
     std::string dtype;
 
     NodeDecl(std::string id, Node *expr, std::string d);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -103,7 +111,7 @@ struct NodeDebug : public Node {
     Node *expression;
 
     NodeDebug(Node *expr);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -114,18 +122,28 @@ struct NodeIdent : public Node {
     std::string identifier;
 
     NodeIdent(std::string ident);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
 struct NodeFunc : public Node {
+    // flags for the `@name`s written before `fun`
+    enum Attribute {
+        MULTIVERSION = 1,
+        MEMO = 2
+    };
+
     std::string identifier;
     std::string dtype;
     NodeStmts *stmtlist;
     NodeArgs *arglist;
+    unsigned attributes;
 
     NodeFunc(std::string ident, std::string d, NodeStmts *stmts, NodeArgs *args);
-    std::string to_string();
+    // flag of the attribute called `name`, 0 if there is none
+    static unsigned attribute(std::string name);
+    std::vector<std::string> attribute_names();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -133,14 +151,14 @@ struct NodeCall : public Node {
     std::string identifier;
     NodeParams *paramlist;
     NodeCall(std::string ident, NodeParams* params);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
 struct NodeReturn : public Node {
     Node *expression;
     NodeReturn(Node *expr);
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 };
 
@@ -152,11 +170,31 @@ struct NodeIfExpr : public Node {
 
     NodeIfExpr(Node* Cond, Node* Then, Node* Else);
    
-    std::string to_string();
+    void accept(Visitor &visitor);
     llvm::Value *llvm_codegen(LLVMCompiler *compiler);
 
 };
 
+/**
+    Node for `par i: T = lo, hi { ... }`. The body runs once for every `i` in
+    [lo, hi), and the iterations can run at the same time on different threads.
+    The body sees the variables around it as they were when the loop started.
+*/
+struct NodePar : public Node {
+    std::string identifier;
+    std::string dtype;
+    Node *lo;
+    Node *hi;
+    NodeStmts *body;
+
+    NodePar(std::string id, std::string d, Node *lo, Node *hi, NodeStmts *body);
+    void accept(Visitor &visitor);
+    llvm::Value *llvm_codegen(LLVMCompiler *compiler);
+};
 
+/**
+    Deletes `node` and everything below it
+*/
+void delete_ast(Node *node);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef CONSTEVAL_HH
+#define CONSTEVAL_HH
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "ast.hh"
+
+// limits for a single compile time call, the call is left alone when hit
+#define CONSTEVAL_MAX_STEPS 1000000
+#define CONSTEVAL_MAX_DEPTH 256
+
+/**
+    Finds the top level functions that are side effect free: they contain no
+    `dbg` and only call functions that are themselves pure.
+*/
+struct PurityAnalysis {
+    std::unordered_map<std::string, NodeFunc*> functions;
+    std::unordered_set<std::string> pure;
+
+    PurityAnalysis() {}
+    PurityAnalysis(NodeStmts *root);
+    void add(NodeFunc *func);
+    bool is_pure(std::string function);
+    bool is_pure_expr(Node *expr);
+};
+
+/**
+    Exits with an error if `func` is `@memo` but not pure, returning a cached
+    result would skip its side effects.
+*/
+void check_memo(NodeFunc *func, PurityAnalysis *purity);
+
+// the same for every function of the program
+void check_memo(NodeStmts *root);
+
+/**
+    Replaces calls to pure functions whose arguments are all constants with the
+    value the call returns, computed by interpreting the function body.
+*/
+void evaluate_constant_calls(NodeStmts *root);
+
+/**
+    Evaluates `node` if it only consists of integer literals, using the same
+    integer widths and wrap around as the LLVM codegen. Returns false if the
+    expression is not a constant (or would trap, e.g. division by zero).
+*/
+bool fold_constant(Node *node, long long &value);
+bool fold_constant(Node *node, long long &value, int &bits);
+
+// width in bits codegen picks for an integer literal, see `NodeInt::llvm_codegen`
+int literal_bits(NodeInt *node);
+
+// width in bits of `short`, `int` and `long`
+int dtype_bits(std::string dtype);
+std::string bits_dtype(int bits);
+
+// truncates `value` to `bits` and sign extends it back, like `CreateIntCast`
+long long wrap_bits(long long value, int bits);
+
+#endif
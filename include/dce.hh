@@ -0,0 +1,23 @@
+#ifndef DCE_HH
+#define DCE_HH
+
+#include "ast.hh"
+#include "consteval.hh"
+
+/**
+    Dead code elimination on the AST, run between parsing and codegen.
+    - drops statements that follow a `ret` in the same block
+    - replaces an `if` whose condition folds to a constant with the taken branch
+    - removes `let` bindings that are never read and have no side effects
+    - removes functions that are not reachable from `main`
+*/
+void eliminate_dead_code(NodeStmts *root);
+
+/**
+    The same within a single function, for programs compiled one function at a
+    time. `purity` must know every function `func` can call; no functions are
+    removed.
+*/
+void eliminate_dead_code(NodeFunc *func, PurityAnalysis *purity);
+
+#endif
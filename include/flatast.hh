@@ -0,0 +1,78 @@
+#ifndef FLATAST_HH
+#define FLATAST_HH
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hh"
+
+// index of a node in `FlatAst::nodes`
+typedef uint32_t NodeRef;
+
+/**
+    A node of the flat AST, 16 bytes. What `a`, `b` and `c` hold depends on
+    the type, strings are indices into `FlatAst::strings`, `dtype` is an index
+    into `FlatAst::dtypes` and lists are a start and a length in `FlatAst::lists`:
+        STMTS   a: first child, b: count
+        ARGS    a: first ARG, b: count
+        PARAMS  a: first expression, b: count
+        ARG     a: name, dtype
+        FUNC    a: name, b: body (STMTS), c: ARGS, dtype, op: attributes
+        ASSN    a: name, b: expression, dtype
+        DBG     a: expression
+        RET     a: expression
+        IF      a: condition, b: then, c: else
+        PAR     a: name, b: body (STMTS), c: PARAMS of lo and hi, dtype
+        BIN_OP  a: left, b: right, op
+        INT_LIT a: index into `FlatAst::ints`, dtype
+        IDENT   a: name
+        CALL    a: name, b: PARAMS
+*/
+struct FlatNode {
+    uint8_t type;
+    uint8_t op;
+    uint16_t dtype;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+/**
+    The AST in a handful of contiguous arrays, children are referred to by
+    32 bit indices instead of pointers and dispatch is on `FlatNode::type`.
+*/
+struct FlatAst {
+    std::vector<FlatNode> nodes;
+    std::vector<NodeRef> lists;
+    std::vector<long long> ints;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> string_ids;
+    // type names, kept apart from `strings` so their ids fit in `FlatNode::dtype`
+    std::vector<std::string> dtypes;
+    NodeRef root;
+
+    uint32_t intern(std::string s);
+    uint16_t intern_dtype(std::string s);
+    NodeRef add(Node *node);
+
+    FlatNode &operator[](NodeRef ref) { return nodes[ref]; }
+    NodeRef *list_begin(FlatNode &node) { return lists.data() + node.a; }
+    NodeRef *list_end(FlatNode &node) { return lists.data() + node.a + node.b; }
+
+    // memory held by the arrays
+    size_t bytes();
+};
+
+/**
+    Flattens the pointer tree under `root`, which is left untouched.
+*/
+FlatAst flatten(NodeStmts *root);
+
+/**
+    Compares the pointer tree and its flattened copy: memory used, and time
+    for a full traversal and for LLVM codegen of each.
+*/
+void ast_benchmark(NodeStmts *root);
+
+#endif
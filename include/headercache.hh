@@ -0,0 +1,45 @@
+#ifndef HEADERCACHE_HH
+#define HEADERCACHE_HH
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// a file a preprocessed header was built from, with its modification time
+struct HeaderDep {
+    std::string path;
+    long long mtime;
+};
+
+/**
+    A preprocessed header: its text after macro expansion and directive removal,
+    the macros defined once it has been read, and every file it was built from.
+*/
+struct HeaderCacheEntry {
+    std::vector<HeaderDep> deps;
+    std::unordered_map<std::string, std::string> macros;
+    std::string text;
+};
+
+/**
+    On disk cache of preprocessed headers, shared by every compiler run started
+    from the same directory. An entry is keyed on the header path and mtime, the
+    macros defined at the `#include` and the headers included before it, and is
+    thrown away when any file it was built from has changed since.
+*/
+struct HeaderCache {
+    std::string dir;
+
+    HeaderCache(std::string dir) : dir(dir) {}
+
+    static std::string make_key(std::string path, long long mtime,
+        std::unordered_map<std::string, std::string> &macros, std::set<std::string> &included);
+    bool lookup(std::string key, HeaderCacheEntry &entry);
+    void store(std::string key, HeaderCacheEntry &entry);
+};
+
+// modification time of `path`, -1 if it does not exist
+long long file_mtime(std::string path);
+
+#endif
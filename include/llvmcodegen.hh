@@ -7,9 +7,14 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
 #include <unordered_map>
 #include <list>
+#include <vector>
 #include "ast.hh"
+#include "range.hh"
+
+struct FlatAst;
 
 using namespace llvm;
 
@@ -28,6 +33,44 @@ struct SymbolsTable {
     void scope();
     void unscope();
 };
+
+/**
+    What codegen knows about an integer value: the range it is in, and the
+    width the language gives it. `bits` is wider than the LLVM type when the
+    arithmetic was done in a narrower type because it cannot overflow.
+*/
+struct KnownRange {
+    Range range;
+    int bits;
+};
+
+/**
+    A `par` loop whose body is being generated, between `LLVMCompiler::begin_par`
+    and `LLVMCompiler::end_par`.
+*/
+struct ParLoop {
+    Function *task;
+    // where the call to the runtime goes, and the symbols in scope there
+    BasicBlock *caller;
+    SymbolsTable caller_symbols;
+    Value *lo;
+    Value *hi;
+    Value *env;
+    AllocaInst *counter;
+    BasicBlock *cond;
+    BasicBlock *exit;
+};
+
+/**
+    The blocks of an `if` whose branches are being generated, between
+    `LLVMCompiler::begin_if`, `LLVMCompiler::begin_else` and `LLVMCompiler::end_if`.
+*/
+struct IfBlocks {
+    Function *func;
+    BasicBlock *else_bb;
+    BasicBlock *merge_bb;
+};
+
 struct LLVMCompiler {
     LLVMContext *context;
     IRBuilder<> builder;
@@ -37,6 +80,16 @@ struct LLVMCompiler {
     std::unordered_map<std::string, int> type_scope;
 
     std::stack<std::string> current_function;
+    // ranges of the values and variables of the function being generated
+    std::unordered_map<Value*, KnownRange> ranges;
+    // print the DEBUG lines while generating code
+    bool debug = true;
+    // set by `set_target`, every function is generated for this CPU
+    TargetMachine *target_machine = nullptr;
+    std::string target_cpu;
+    std::string target_features;
+    // bitcode of runtime/runtime_lib.cc, empty to leave the runtime to the linker
+    std::string runtime;
     
     LLVMCompiler(LLVMContext *context, std::string file_name) : 
         context(context), builder(*context), module(file_name, *context) {
@@ -48,10 +101,53 @@ struct LLVMCompiler {
         type_scope["long"] = 64;
         module.getFunction("printi");
     }
+    ~LLVMCompiler() {
+        delete target_machine;
+    }
     
     void compile(Node *root);
+    void compile_flat(FlatAst &ast);
+    void compile_parallel(NodeStmts *root, int jobs, int opt_level);
+    void declare_runtime();
+    void link_runtime();
+    Function *declare(NodeFunc *func);
+    Function *declare(std::string identifier, std::string dtype, const std::vector<std::string> &arg_dtypes);
+
+    // the IR of each kind of node, the codegen of the pointer tree and of the
+    // flat AST only decode their nodes and call these
+    Value *emit_debug(Value *expr);
+    Value *emit_int(long long value, std::string dtype);
+    Value *emit_decl(std::string identifier, std::string dtype, Value *expr);
+    Value *emit_load(std::string identifier);
+    Value *emit_return(Value *expr);
+    Function *callee(std::string identifier, size_t num_args);
+    Function *begin_func(std::string identifier, std::string dtype, const std::vector<std::string> &arg_names,
+        const std::vector<std::string> &arg_dtypes, int attributes);
+    void end_func(Function *func, int attributes);
+    IfBlocks begin_if(Value *cond);
+    void begin_else(IfBlocks &blocks);
+    void end_if(IfBlocks &blocks);
+    ParLoop begin_par(std::string identifier, std::string dtype, Value *lo, Value *hi,
+        const std::vector<std::string> &names);
+    void end_par(ParLoop &loop);
+    void memoize(Function *func);
+    void optimize(int level);
+    void set_target(std::string cpu);
+    void set_target(std::string cpu, std::string features);
+    void set_target_attributes(Function *func);
+    void multiversion();
+    std::vector<Function*> multiversion(Function *func);
+    Range range(Value *value);
+    int value_bits(Value *value);
     void dump();
     void write(std::string file_name);
 };
 
+// helpers shared by the codegen of the pointer tree and of the flat AST
+Type* gType(std::string dtype, LLVMCompiler *compiler);
+Value* TypeConversion(Value *expr, Type* ty, LLVMCompiler *compiler);
+Value* CreateBinOp(int op, Value *left, Value *right, LLVMCompiler *compiler);
+AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, StringRef VarName, Type *ty);
+void debug_log(LLVMCompiler *compiler, std::string line);
+
 #endif
\ No newline at end of file
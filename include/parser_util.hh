@@ -1,22 +1,47 @@
 #ifndef PARSER_UTIL_HH
 #define PARSER_UTIL_HH
 
+#include <cstddef>
+#include <functional>
 #include <string>
 #include <vector>
 
 #include "ast.hh"
 
 /**
-    Intermediate strcuct used by bison
+    Text of a TIDENT, DTYPE or TATTR token. Every distinct spelling is stored
+    once for the whole run by `intern`, so a lexeme is one pointer: it costs
+    nothing to move through the parser's stack and stays valid after the
+    scanner has moved on. TINT_LIT carries its value instead, numbers are not
+    interned since a `-stream` run would keep every distinct one until the end.
 */
-struct ParserValue {
-    std::string lexeme;
-
-    Node *node;
-    NodeStmts *stmts;
-    NodeArg *arg;
-    NodeArgs *args;
-    NodeParams *params;
+struct Lexeme {
+    const std::string *text;
+
+    Lexeme() : text(nullptr) {}
+    explicit Lexeme(const std::string *text) : text(text) {}
+
+    const std::string &str() const { return *text; }
+    operator const std::string&() const { return *text; }
+    bool operator==(const Lexeme &other) const { return text == other.text; }
+    bool operator!=(const Lexeme &other) const { return text != other.text; }
 };
 
-#endif
\ No newline at end of file
+// the lexeme spelled by `length` bytes at `text`
+Lexeme intern(const char *text, size_t length);
+
+// the value of the TINT_LIT spelled by `length` bytes at `text`
+long long int_literal(const char *text, size_t length);
+
+// lexeme of the last token `yylex` returned, if it is one that has a lexeme
+extern Lexeme token_lexeme;
+// value of the last TINT_LIT `yylex` returned
+extern long long token_int;
+
+/**
+    When set, called with every top level function as soon as it has been
+    parsed, instead of adding it to the program's statements.
+*/
+extern std::function<void(NodeFunc*)> top_level_function;
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef PRINTER_HH
+#define PRINTER_HH
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ast.hh"
+#include "visitor.hh"
+
+/**
+    Writes the S-expression form of the AST, the output of `-p`, straight to
+    a stream.
+*/
+struct SExprPrinter : Visitor {
+    std::ostream &out;
+
+    SExprPrinter(std::ostream &out) : out(out) {}
+
+    void visit(NodeStmts *node);
+    void visit(NodeArg *node);
+    void visit(NodeArgs *node);
+    void visit(NodeParams *node);
+    void visit(NodeBinOp *node);
+    void visit(NodeInt *node);
+    void visit(NodeDecl *node);
+    void visit(NodeDebug *node);
+    void visit(NodeIdent *node);
+    void visit(NodeFunc *node);
+    void visit(NodeCall *node);
+    void visit(NodeReturn *node);
+    void visit(NodeIfExpr *node);
+    void visit(NodePar *node);
+};
+
+/**
+    Writes the AST as JSON (`-p=json`), on a single line. Every node is an
+    object with a `kind` and its fields:
+        stmts  body: [node]
+        fun    name, type, attributes: [name], args: [{name, type}], body: stmts
+        let    name, type, value
+        dbg    value
+        ret    value
+        if     cond, then, else
+        par    name, type, lo, hi, body: stmts
+        binop  op ("+", "-", "*" or "/"), left, right
+        int    value, type (only when fixed by constant folding)
+        ident  name
+        call   name, args: [node]
+*/
+struct JsonPrinter : Visitor {
+    std::ostream &out;
+
+    JsonPrinter(std::ostream &out) : out(out) {}
+
+    void string(std::string s);
+    void list(std::vector<Node*> &nodes);
+
+    void visit(NodeStmts *node);
+    void visit(NodeArg *node);
+    void visit(NodeArgs *node);
+    void visit(NodeParams *node);
+    void visit(NodeBinOp *node);
+    void visit(NodeInt *node);
+    void visit(NodeDecl *node);
+    void visit(NodeDebug *node);
+    void visit(NodeIdent *node);
+    void visit(NodeFunc *node);
+    void visit(NodeCall *node);
+    void visit(NodeReturn *node);
+    void visit(NodeIfExpr *node);
+    void visit(NodePar *node);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef RANGE_HH
+#define RANGE_HH
+
+/**
+    Closed interval of the values an integer expression can take. Used by the
+    codegens to do arithmetic in the narrowest width that cannot overflow, and
+    to accept a `let`, argument or `ret` of a wider expression when its value
+    is proven to fit the narrower type.
+*/
+struct Range {
+    long long lo;
+    long long hi;
+};
+
+// every value of a `bits` wide signed integer
+Range full_range(int bits);
+
+bool range_fits(Range range, int bits);
+
+// narrowest of 16, 32 and 64 bits that holds every value in `range`
+int range_bits(Range range);
+
+/**
+    Range of `left op right` (a `NodeBinOp::Op`) computed in `bits` wide
+    integers, the way codegen does it. Sets `wraps` if the result can overflow
+    or the divisor can only be zero, the range is then all of `bits`.
+*/
+Range range_binop(int op, Range left, Range right, int bits, bool &wraps);
+
+// values the variable of a `par` loop takes, for bounds in `lo` and `hi`
+Range range_index(Range lo, Range hi);
+
+#endif
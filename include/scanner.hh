@@ -0,0 +1,52 @@
+#ifndef SCANNER_HH
+#define SCANNER_HH
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "parser_util.hh"
+
+/**
+    Hand written alternative to the flex scanner in src/lexer.lex, producing
+    the same token stream. Runs of whitespace, digits and letters are measured
+    16 (SSE2) or 32 (AVX2) bytes at a time and keywords are matched with a
+    perfect hash. The whole input is read into one buffer up front.
+*/
+struct FastScanner {
+    std::vector<char> buffer;
+    const char *pos;
+    const char *end;
+
+    FastScanner() : pos(nullptr), end(nullptr) {}
+
+    void load(FILE *file);
+    int next(Lexeme &lexeme, long long &value);
+};
+
+// a token and, for tokens that carry one, its lexeme or value
+struct LexedToken {
+    int token;
+    Lexeme lexeme;
+    long long value;
+
+    bool operator!=(const LexedToken &other) const {
+        return token != other.token || lexeme != other.lexeme || value != other.value;
+    }
+};
+
+// TIDENT, DTYPE and TATTR
+bool has_lexeme(int token);
+
+// next token of `yyin` from the scanner picked by `use_fast_scanner`, 0 at the end
+int yylex();
+
+// `yylex` uses the fast scanner instead of flex when set (`-scanner=simd`)
+extern bool use_fast_scanner;
+
+// vector extension the fast scanner uses on this machine
+const char *fast_scanner_isa();
+
+// lexes `file` with both scanners, checks that they agree and prints their speed
+void scanner_benchmark(FILE *file);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef SERIALIZE_HH
+#define SERIALIZE_HH
+
+#include <string>
+#include "ast.hh"
+
+// bumped whenever the layout of AST files changes
+#define AST_FILE_VERSION 2
+
+/**
+    Binary AST files, written with `-emit-ast` and read back with `-load-ast`.
+
+    A file starts with the magic "BEAS" and AST_FILE_VERSION (4 bytes, little
+    endian), followed by the string table (count, then length and bytes of
+    every string) and the record of the root node. A record is a tag byte
+    followed by the fields of the node, children are nested records.
+    Integers are LEB128 varints, zigzag encoded when signed, and identifiers
+    and types are indices into the string table.
+*/
+void write_ast(NodeStmts *root, std::string file_name);
+
+/**
+    Maps `file_name` and rebuilds the tree. Exits with an error if the file is
+    not an AST file of the current version.
+*/
+NodeStmts *read_ast(std::string file_name);
+
+#endif
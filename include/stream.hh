@@ -0,0 +1,50 @@
+#ifndef STREAM_HH
+#define STREAM_HH
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include "ast.hh"
+#include "consteval.hh"
+#include "llvmcodegen.hh"
+
+/**
+    Compiles a program one top level function at a time, while it is being
+    parsed. Every function goes through dead code elimination, codegen and
+    optimization on its own and is then deleted, so at most one function's AST
+    is in memory. When printing IR, finished functions are printed right away
+    and removed from the module as well, functions calling them get a new
+    declaration from `signatures`.
+
+    Calls are not evaluated at compile time and unreachable functions are not
+    removed, both need the whole program. There is no inliner run over the
+    module either, calls to the runtime are inlined by hand before optimizing.
+*/
+struct StreamCompiler {
+    LLVMCompiler *compiler;
+    bool print_ir;
+    int opt_level;
+    PurityAnalysis purity;
+    std::unordered_map<std::string, FunctionType*> signatures;
+    // definitions linked in by `LLVMCompiler::link_runtime`
+    std::unordered_set<Function*> runtime_functions;
+    // attribute groups referenced by printed IR, in the order they are numbered
+    std::vector<AttributeSet> attribute_sets;
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    FunctionPassManager FPM;
+
+    StreamCompiler(LLVMCompiler *compiler, bool print_ir, int opt_level);
+    void function(NodeFunc *func);
+    void finish(NodeStmts *rest);
+    void keep_attributes(const std::vector<Function*> &functions);
+};
+
+#endif
@@ -11,9 +11,9 @@
 struct SymbolTable {
     std::list<std::set<std::string>> table;
 
-    bool contains(std::string key);
-    bool containsScope(std::string key);
-    void insert(std::string key);
+    bool contains(const std::string &key);
+    bool containsScope(const std::string &key);
+    void insert(const std::string &key);
     void scope();
     void unscope();
 };
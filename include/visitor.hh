@@ -0,0 +1,40 @@
+#ifndef VISITOR_HH
+#define VISITOR_HH
+
+#include <string>
+#include <vector>
+#include "ast.hh"
+
+/**
+    Visitor over the `Node` hierarchy, `node->accept(visitor)` calls the
+    `visit` overload for the node's type. By default every `visit` visits the
+    node's children in evaluation order, so a pass only overrides the nodes it
+    is interested in and calls the base version to keep descending (with
+    `using Visitor::visit` so the other overloads stay visible).
+*/
+struct Visitor {
+    virtual ~Visitor() {}
+
+    virtual void visit(NodeStmts *node);
+    virtual void visit(NodeArg *node);
+    virtual void visit(NodeArgs *node);
+    virtual void visit(NodeParams *node);
+    virtual void visit(NodeBinOp *node);
+    virtual void visit(NodeInt *node);
+    virtual void visit(NodeDecl *node);
+    virtual void visit(NodeDebug *node);
+    virtual void visit(NodeIdent *node);
+    virtual void visit(NodeFunc *node);
+    virtual void visit(NodeCall *node);
+    virtual void visit(NodeReturn *node);
+    virtual void visit(NodeIfExpr *node);
+    virtual void visit(NodePar *node);
+};
+
+// names of the functions called under `node`, in evaluation order and repeated
+void collect_calls(Node *node, std::vector<std::string> &callees);
+
+// names of the variables read under `node`, in evaluation order and repeated
+void collect_identifiers(Node *node, std::vector<std::string> &names);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef VM_HH
+#define VM_HH
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hh"
+#include "range.hh"
+#include "visitor.hh"
+
+// deepest call chain the interpreter allows before giving up
+#define VM_MAX_FRAMES (1 << 20)
+
+/**
+    Instruction set of the register VM. `a` is the destination register unless
+    noted, `b` and `c` are source registers.
+*/
+enum VMOp : uint16_t {
+    OP_LOADI,   // a = b (32 bit immediate)
+    OP_LOADK,   // a = constants[b]
+    OP_MOVE,    // a = b
+    OP_ADD,     // a = b + c
+    OP_SUB,     // a = b - c
+    OP_MUL,     // a = b * c
+    OP_DIV,     // a = b / c
+    OP_WRAP16,  // a = sign extended low 16 bits of a
+    OP_WRAP32,  // a = sign extended low 32 bits of a
+    OP_JZ,      // if a == 0 jump to b
+    OP_JMP,     // jump to b
+    OP_CALL,    // a = functions[b](c, c + 1, ...)
+    OP_RET,     // return a
+    OP_PRINT,   // printi(a)
+    OP_LT,      // a = b < c
+    OP_COUNT
+};
+
+struct VMInstr {
+    VMOp op;
+    uint16_t a;
+    int32_t b;
+    int32_t c;
+};
+
+struct VMFunction {
+    std::string name;
+    int num_args;
+    int num_regs;
+    // `@memo`, results are cached by arguments while the program runs
+    bool memo;
+    std::vector<VMInstr> code;
+};
+
+struct VMProgram {
+    std::vector<VMFunction> functions;
+    std::vector<long long> constants;
+    int main_index;
+};
+
+/**
+    Lowers the AST to register bytecode. Every value carries the integer width
+    the LLVM codegen would give it, so arithmetic wraps the same way, and its
+    range, so the same narrowing errors are reported.
+*/
+struct VMCompiler : Visitor {
+    // a named register, the width of the variable it holds and its range
+    struct Slot {
+        int reg;
+        int bits;
+        Range range;
+    };
+
+    VMProgram program;
+    std::unordered_map<std::string, int> function_index;
+    std::unordered_map<std::string, NodeFunc*> function_nodes;
+
+    VMFunction *current;
+    int return_bits;
+    int next_reg;
+    std::list<std::unordered_map<std::string, Slot>> scopes;
+
+    // the register, width and range of the expression visited last
+    int result;
+    int result_bits;
+    Range result_range;
+    // set by a `let`, whose variable keeps the first register of the statement
+    bool declared;
+
+    VMProgram compile(NodeStmts *root);
+
+    void compile_function(NodeFunc *func);
+    void compile_stmt(Node *node);
+    int compile_expr(Node *node, int &bits, Range &range);
+
+    using Visitor::visit;
+    void visit(NodeStmts *node);
+    void visit(NodeDecl *node);
+    void visit(NodeDebug *node);
+    void visit(NodeReturn *node);
+    void visit(NodeIfExpr *node);
+    void visit(NodePar *node);
+    void visit(NodeFunc *node);
+    void visit(NodeInt *node);
+    void visit(NodeIdent *node);
+    void visit(NodeBinOp *node);
+    void visit(NodeCall *node);
+
+    int alloc_reg();
+    int emit(VMOp op, int a, int b = 0, int c = 0);
+    void move_into(int dst, int src);
+    void check_width(Range range, int from, int to);
+};
+
+/**
+    Runs `main` of the program, returns its return value.
+*/
+long long vm_run(VMProgram &program);
+
+#endif
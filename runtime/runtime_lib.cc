@@ -1,6 +1,442 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+// the compiler links this file in as bitcode (bin/runtime.bc), `dbg` calls
+// `printi` with a 64 bit value. The line is written with a single call, which
+// locks stdout, so lines printed by `par` iterations running at the same time
+// never mix
+extern "C"
+void printi(long long i) {
+    char line[24];
+    int length = snprintf(line, sizeof(line), "%lld\n", i);
+    fwrite(line, 1, length, stdout);
+}
+
+#if defined(__x86_64__)
+// `bit` of a cpuid register
+#define CPU_HAS(reg, bit) (((reg) >> (bit)) & 1)
+
+// the state the OS saves on context switches, XCR0, only readable once cpuid
+// says OSXSAVE
+static unsigned long long cpu_xcr0() {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long) edx << 32) | eax;
+}
+#endif
+
+// highest x86-64 level (1 to 4) the CPU running the program supports, asked by
+// the ifunc resolvers of `@multiversion` functions. Every feature of the psABI
+// levels is checked, like compiler-rt's `__cpu_indicator_init` does, and AVX and
+// AVX-512 also need the OS to save their registers. Level 1 is all of x86-64
+extern "C"
+int be_cpu_level() {
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 1;
+    }
+    unsigned int ecx1 = ecx;
+    unsigned int ecx_ext = 0;
+    if(__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+        ecx_ext = ecx;
+    }
+    unsigned int ebx7 = 0;
+    if(__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        ebx7 = ebx;
+    }
+
+    // x86-64-v2: sse3, ssse3, cx16, sse4.1, sse4.2, popcnt and lahf
+    if(!CPU_HAS(ecx1, 0) || !CPU_HAS(ecx1, 9) || !CPU_HAS(ecx1, 13) || !CPU_HAS(ecx1, 19)
+        || !CPU_HAS(ecx1, 20) || !CPU_HAS(ecx1, 23) || !CPU_HAS(ecx_ext, 0)) {
+        return 1;
+    }
+
+    // x86-64-v3: fma, movbe, avx, f16c, lzcnt, bmi1, avx2 and bmi2, with the
+    // XMM and YMM state enabled by the OS
+    unsigned long long xcr0 = CPU_HAS(ecx1, 27) ? cpu_xcr0() : 0;
+    if(!CPU_HAS(ecx1, 12) || !CPU_HAS(ecx1, 22) || !CPU_HAS(ecx1, 28) || !CPU_HAS(ecx1, 29)
+        || !CPU_HAS(ecx_ext, 5) || !CPU_HAS(ebx7, 3) || !CPU_HAS(ebx7, 5) || !CPU_HAS(ebx7, 8)
+        || (xcr0 & 0x6) != 0x6) {
+        return 2;
+    }
+
+    // x86-64-v4: avx512f, avx512dq, avx512cd, avx512bw and avx512vl, with the
+    // opmask and ZMM state enabled as well
+    if(!CPU_HAS(ebx7, 16) || !CPU_HAS(ebx7, 17) || !CPU_HAS(ebx7, 28) || !CPU_HAS(ebx7, 30)
+        || !CPU_HAS(ebx7, 31) || (xcr0 & 0xe6) != 0xe6) {
+        return 3;
+    }
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+//  ┌―――――――――――――――――――――――――――┐  //
+//  │ Work-stealing thread pool │  //
+// └―――――――――――――――――――――――――――┘   //
+
+/*
+Runs the `par` loops. Every thread of the pool, and the thread that started the
+loop, has a queue of ranges of iterations. A thread works on the newest range
+of its own queue and, when that is empty, steals the oldest (and largest) range
+of another. Ranges are halved as they are taken, down to a grain of a few
+ranges per thread, so idle threads always find a big piece of work to steal.
+The thread that started a loop works on it too until every iteration is done.
+
+`be_parallel_for` keeps state for the whole process, so it is not linked into
+the modules as bitcode with the rest of this file, see `link_runtime`.
+*/
+
+// ranges a loop is cut into per thread, at least
+#define PAR_RANGES_PER_THREAD 8
+
+typedef void (*ParBody)(long long lo, long long hi, void *env);
+
+struct ParLoop {
+    ParBody body;
+    void *env;
+    unsigned long long grain;
+    // iterations that have not finished yet
+    std::atomic<unsigned long long> remaining;
+};
+
+struct ParRange {
+    ParLoop *loop;
+    long long lo;
+    long long hi;
+};
+
+struct ParQueue {
+    std::mutex mutex;
+    std::deque<ParRange> ranges;
+};
+
+struct ParPool {
+    // one per thread, 0 is for the threads outside of the pool
+    std::vector<ParQueue> queues;
+    // ranges in all queues, negative for a moment when one is taken as it is added
+    std::atomic<long long> queued;
+    std::atomic<int> sleeping;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+
+    ParPool(int threads) : queues(threads), queued(0), sleeping(0) {}
+};
+
+static thread_local int queue_index = 0;
+
+static void push(ParPool *pool, ParRange range) {
+    ParQueue &queue = pool->queues[queue_index];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.ranges.push_back(range);
+    }
+    pool->queued++;
+    if(pool->sleeping > 0) {
+        // a thread going to sleep holds the lock until it waits
+        std::lock_guard<std::mutex> lock(pool->sleep_mutex);
+        pool->wake.notify_one();
+    }
+}
+
+// the newest range of this thread's queue, or else the oldest of another's
+static bool take(ParPool *pool, ParRange &range) {
+    if(pool->queued <= 0) {
+        return false;
+    }
+    int count = pool->queues.size();
+    for(int i = 0; i < count; i++) {
+        int victim = (queue_index + i) % count;
+        ParQueue &queue = pool->queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(queue.ranges.empty()) {
+            continue;
+        }
+        if(i == 0) {
+            range = queue.ranges.back();
+            queue.ranges.pop_back();
+        } else {
+            range = queue.ranges.front();
+            queue.ranges.pop_front();
+        }
+        pool->queued--;
+        return true;
+    }
+    return false;
+}
+
+// runs the first half of `range` until it is down to the grain, the second
+// halves are left to whichever thread takes them
+static void run(ParPool *pool, ParRange range) {
+    ParLoop *loop = range.loop;
+    unsigned long long size = (unsigned long long) range.hi - (unsigned long long) range.lo;
+    while(size > loop->grain) {
+        long long mid = range.lo + (long long) (size / 2);
+        push(pool, {loop, mid, range.hi});
+        range.hi = mid;
+        size = (unsigned long long) range.hi - (unsigned long long) range.lo;
+    }
+    loop->body(range.lo, range.hi, loop->env);
+    // the last use of `loop`, whoever waits for it may return right after
+    loop->remaining -= size;
+}
+
+static void work(ParPool *pool, int index) {
+    queue_index = index;
+    for(;;) {
+        ParRange range;
+        if(take(pool, range)) {
+            run(pool, range);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(pool->sleep_mutex);
+        pool->sleeping++;
+        pool->wake.wait(lock, [&]() { return pool->queued > 0; });
+        pool->sleeping--;
+    }
+}
+
+// `BE_THREADS` threads in all, or one per core. Never freed, the threads run
+// until the program exits
+static ParPool *start_pool() {
+    int threads = std::thread::hardware_concurrency();
+    if(const char *env = getenv("BE_THREADS")) {
+        threads = atoi(env);
+    }
+    if(threads < 1) {
+        threads = 1;
+    }
+    ParPool *pool = new ParPool(threads);
+    for(int i = 1; i < threads; i++) {
+        std::thread(work, pool, i).detach();
+    }
+    return pool;
+}
+
+// runs `body` over [lo, hi) on the pool and returns once all of it has run
+extern "C"
+void be_parallel_for(long long lo, long long hi, ParBody body, void *env) {
+    if(hi <= lo) {
+        return;
+    }
+    static ParPool *pool = start_pool();
+    int threads = pool->queues.size();
+    unsigned long long size = (unsigned long long) hi - (unsigned long long) lo;
+    if(threads == 1) {
+        body(lo, hi, env);
+        return;
+    }
+
+    ParLoop loop;
+    loop.body = body;
+    loop.env = env;
+    loop.grain = size / ((unsigned long long) threads * PAR_RANGES_PER_THREAD);
+    if(loop.grain == 0) {
+        loop.grain = 1;
+    }
+    loop.remaining = size;
+
+    run(pool, {&loop, lo, hi});
+    // help out, with this loop or any other, until the stolen ranges are done
+    while(loop.remaining > 0) {
+        ParRange range;
+        if(take(pool, range)) {
+            run(pool, range);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+//  ┌―――――――――――――┐  //
+//  │ Memo tables │  //
+// └―――――――――――――┘   //
+
+/*
+Caches the results of `@memo` functions, one open addressing hash table per
+function. A table grows from `MEMO_INITIAL_SLOTS` by doubling while it is more
+than half full, up to `BE_MEMO_SIZE` slots (65536 by default). Once it is that
+big, a key that finds no free slot among its first few replaces the one at its
+home slot, so memory stays bounded and recent results win. A lock per table
+keeps the lookups of `par` iterations running at the same time apart.
+
+Like `be_parallel_for`, the tables live for the whole process and are not
+linked in as bitcode, see `link_runtime`. With `BE_MEMO_STATS` set, the hits
+and misses of every table are printed to stderr when the program exits.
+*/
+
+#define MEMO_INITIAL_SLOTS 64
+#define MEMO_DEFAULT_SIZE (1 << 16)
+#define MEMO_PROBES 8
+
+struct MemoTable {
+    std::mutex mutex;
+    const char *name;
+    long long args;
+    // a slot is `args + 2` values, [used, value, key...]
+    unsigned long long capacity;
+    unsigned long long used;
+    std::vector<long long> slots;
+    unsigned long long hits;
+    unsigned long long misses;
+    MemoTable *next;
+};
+
+// the global the compiler generates for every `@memo` function
+struct MemoCache {
+    std::atomic<MemoTable*> table;
+    const char *name;
+    long long args;
+};
+
+// every table, newest first. No constructors here, nothing of this section
+// should run in the programs this file is linked into as bitcode
+static std::mutex memo_mutex;
+static MemoTable *memo_tables = nullptr;
+
+static unsigned long long memo_size() {
+    unsigned long long size = MEMO_DEFAULT_SIZE;
+    if(const char *env = getenv("BE_MEMO_SIZE")) {
+        size = strtoull(env, nullptr, 10);
+    }
+    unsigned long long slots = MEMO_INITIAL_SLOTS;
+    while(slots < size) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+static void memo_stats() {
+    std::lock_guard<std::mutex> lock(memo_mutex);
+    for(MemoTable *table = memo_tables; table; table = table->next) {
+        fprintf(stderr, "memo %s: %llu hits, %llu misses, %llu entries\n",
+            table->name, table->hits, table->misses, table->used);
+    }
+}
+
+static MemoTable *memo_table(MemoCache *cache) {
+    MemoTable *table = cache->table.load(std::memory_order_acquire);
+    if(table) {
+        return table;
+    }
+    std::lock_guard<std::mutex> lock(memo_mutex);
+    table = cache->table.load(std::memory_order_relaxed);
+    if(!table) {
+        if(!memo_tables && getenv("BE_MEMO_STATS")) {
+            atexit(memo_stats);
+        }
+        table = new MemoTable();
+        table->name = cache->name;
+        table->args = cache->args;
+        table->capacity = MEMO_INITIAL_SLOTS;
+        table->used = 0;
+        table->slots.assign(MEMO_INITIAL_SLOTS * (cache->args + 2), 0);
+        table->hits = 0;
+        table->misses = 0;
+        table->next = memo_tables;
+        memo_tables = table;
+        cache->table.store(table, std::memory_order_release);
+    }
+    return table;
+}
+
+static unsigned long long memo_hash(const long long *key, long long args) {
+    unsigned long long hash = 0x9e3779b97f4a7c15ULL;
+    for(long long i = 0; i < args; i++) {
+        hash = (hash ^ (unsigned long long) key[i]) * 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+// the slot holding `key`, or else the free slot it would go to, or null
+static long long *memo_find(MemoTable *table, const long long *key) {
+    long long stride = table->args + 2;
+    unsigned long long mask = table->capacity - 1;
+    unsigned long long index = memo_hash(key, table->args) & mask;
+    for(int probe = 0; probe < MEMO_PROBES; probe++) {
+        long long *slot = &table->slots[((index + probe) & mask) * stride];
+        if(!slot[0]) {
+            return slot;
+        }
+        bool same = true;
+        for(long long i = 0; i < table->args && same; i++) {
+            same = slot[i + 2] == key[i];
+        }
+        if(same) {
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+static void memo_grow(MemoTable *table) {
+    long long stride = table->args + 2;
+    std::vector<long long> old;
+    old.swap(table->slots);
+    table->capacity *= 2;
+    table->slots.assign(table->capacity * stride, 0);
+    table->used = 0;
+    for(size_t i = 0; i < old.size(); i += stride) {
+        long long *slot = old[i] ? memo_find(table, &old[i + 2]) : nullptr;
+        if(slot) {
+            std::copy(&old[i], &old[i] + stride, slot);
+            table->used++;
+        }
+    }
+}
+
+// 1 and the cached result in `value` if `key` is in the table, 0 otherwise
+extern "C"
+int be_memo_lookup(MemoCache *cache, const long long *key, long long *value) {
+    MemoTable *table = memo_table(cache);
+    std::lock_guard<std::mutex> lock(table->mutex);
+    long long *slot = memo_find(table, key);
+    if(slot && slot[0]) {
+        table->hits++;
+        *value = slot[1];
+        return 1;
+    }
+    table->misses++;
+    return 0;
+}
 
 extern "C"
-void printi(int i) {
-    printf("%d\n", i);
-}
\ No newline at end of file
+void be_memo_store(MemoCache *cache, const long long *key, long long value) {
+    MemoTable *table = memo_table(cache);
+    long long stride = table->args + 2;
+    static const unsigned long long limit = memo_size();
+    std::lock_guard<std::mutex> lock(table->mutex);
+    if(table->used * 2 >= table->capacity && table->capacity < limit) {
+        memo_grow(table);
+    }
+    long long *slot = memo_find(table, key);
+    if(!slot) {
+        if(table->capacity < limit) {
+            memo_grow(table);
+            slot = memo_find(table, key);
+        }
+        if(!slot) {
+            slot = &table->slots[(memo_hash(key, table->args) & (table->capacity - 1)) * stride];
+        }
+    }
+    if(!slot[0]) {
+        table->used++;
+    }
+    slot[0] = 1;
+    slot[1] = value;
+    std::copy(key, key + table->args, slot + 2);
+}
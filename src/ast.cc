@@ -1,8 +1,19 @@
 #include "ast.hh"
+#include "printer.hh"
+#include "visitor.hh"
 
+#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
+std::string Node::to_string() {
+    std::ostringstream out;
+    SExprPrinter printer(out);
+    accept(printer);
+    return out.str();
+}
+
 NodeBinOp::NodeBinOp(NodeBinOp::Op ope, Node *leftptr, Node *rightptr) {
     type = BIN_OP;
     op = ope;
@@ -10,27 +21,18 @@ NodeBinOp::NodeBinOp(NodeBinOp::Op ope, Node *leftptr, Node *rightptr) {
     right = rightptr;
 }
 
-std::string NodeBinOp::to_string() {
-    std::string out = "(";
-    switch(op) {
-        case PLUS: out += '+'; break;
-        case MINUS: out += '-'; break;
-        case MULT: out += '*'; break;
-        case DIV: out += '/'; break;
-    }
-
-    out += ' ' + left->to_string() + ' ' + right->to_string() + ')';
-
-    return out;
+void NodeBinOp::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
-NodeInt::NodeInt(long long val) {
+NodeInt::NodeInt(long long val, std::string d) {
     type = INT_LIT;
     value = val;
+    dtype = d;
 }
 
-std::string NodeInt::to_string() {
-    return std::to_string(value);
+void NodeInt::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeStmts::NodeStmts() {
@@ -42,18 +44,12 @@ void NodeStmts::push_back(Node *node) {
     list.push_back(node);
 }
 
-std::string NodeStmts::to_string() {
-    std::string out = "(begin";
-    for(auto i : list) {
-        out += " " + i->to_string();
-    }
-
-    out += ')';
-
-    return out;
+void NodeStmts::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeArgs::NodeArgs() {
+    type = ARGS;
     list = std::vector<NodeArg*>();
 }
 
@@ -61,23 +57,18 @@ void NodeArgs::push_back(NodeArg *node) {
     list.push_back(node);
 }
 
-std::string NodeArgs::to_string() {
-    std::string out = "(";
-    for(auto i : list) {
-        out += " " + i->to_string();
-    }
-
-    out += ')';
-
-    return out;
+void NodeArgs::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeArg::NodeArg(std::string id, std::string d) {
+    type = ARG;
     identifier = id;
     dtype = d;
 }
 
 NodeParams::NodeParams() {
+    type = PARAMS;
     list = std::vector<Node*>();
 }
 
@@ -85,19 +76,12 @@ void NodeParams::push_back(Node *node) {
     list.push_back(node);
 }
 
-std::string NodeParams::to_string() {
-    std::string out = "(";
-    for(auto i : list) {
-        out += " " + i->to_string();
-    }
-
-    out += ')';
-
-    return out;
+void NodeParams::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
-std::string NodeArg::to_string() {
-    return "(" + dtype + " " + identifier + ")";
+void NodeArg::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeDecl::NodeDecl(std::string id, Node *expr, std::string d) {
@@ -107,8 +91,8 @@ NodeDecl::NodeDecl(std::string id, Node *expr, std::string d) {
     dtype = d;
 }
 
-std::string NodeDecl::to_string() {
-    return "(let (" + identifier + " " + dtype + ") " + expression->to_string() + ")";
+void NodeDecl::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeDebug::NodeDebug(Node *expr) {
@@ -116,53 +100,126 @@ NodeDebug::NodeDebug(Node *expr) {
     expression = expr;
 }
 
-std::string NodeDebug::to_string() {
-    return "(dbg " + expression->to_string() + ")";
+void NodeDebug::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeIdent::NodeIdent(std::string ident) {
+    type = IDENT;
     identifier = ident;
 }
-std::string NodeIdent::to_string() {
-    return identifier;
+void NodeIdent::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeFunc::NodeFunc(std::string ident, std::string d, NodeStmts *stmts, NodeArgs* args) {
+    type = FUNC;
     identifier = ident;
     dtype = d;
     stmtlist = stmts;
     arglist = args;
+    attributes = 0;
+}
+
+static const std::pair<const char*, unsigned> function_attributes[] = {
+    {"multiversion", NodeFunc::MULTIVERSION},
+    {"memo", NodeFunc::MEMO}
+};
+
+unsigned NodeFunc::attribute(std::string name) {
+    for(auto &i : function_attributes) {
+        if(name == i.first) {
+            return i.second;
+        }
+    }
+    return 0;
+}
+
+std::vector<std::string> NodeFunc::attribute_names() {
+    std::vector<std::string> names;
+    for(auto &i : function_attributes) {
+        if(attributes & i.second) {
+            names.push_back(i.first);
+        }
+    }
+    return names;
 }
 
-std::string NodeFunc::to_string() {
-    return "(fun " + dtype + " " + identifier + " args" + arglist->to_string() + " body" + stmtlist->to_string() + ")";
+void NodeFunc::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeCall::NodeCall(std::string ident, NodeParams* params) {
+    type = CALL;
     identifier = ident;
     paramlist = params;
 }
 
-std::string NodeCall::to_string() {
-    return "(call " + identifier + " (" + paramlist->to_string() +"))"; 
+void NodeCall::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeReturn::NodeReturn(Node *expr) {
+    type = RET;
     expression = expr;
 }
 
-std::string NodeReturn::to_string() {
-    return "(ret " + expression->to_string() + ")";
+void NodeReturn::accept(Visitor &visitor) {
+    visitor.visit(this);
 }
 
 NodeIfExpr::NodeIfExpr(Node* cond, Node* then, Node* el)
 {
+    type = IF;
     Cond = cond;
     Then  = then;
     Else = el;
 }
 
-std::string NodeIfExpr::to_string()
-{
-    return "(if " + Cond->to_string() + " " + Then->to_string() + " " + Else->to_string() + " )";
-}
\ No newline at end of file
+void NodeIfExpr::accept(Visitor &visitor) {
+    visitor.visit(this);
+}
+
+NodePar::NodePar(std::string id, std::string d, Node *lo, Node *hi, NodeStmts *body) {
+    type = PAR;
+    identifier = id;
+    dtype = d;
+    this->lo = lo;
+    this->hi = hi;
+    this->body = body;
+}
+
+void NodePar::accept(Visitor &visitor) {
+    visitor.visit(this);
+}
+
+// deletes every node after its children, argument and parameter lists included
+struct AstDeleter : Visitor {
+#define DELETE_AFTER_CHILDREN(type) \
+    void visit(type *node) { \
+        Visitor::visit(node); \
+        delete node; \
+    }
+
+    DELETE_AFTER_CHILDREN(NodeStmts)
+    DELETE_AFTER_CHILDREN(NodeArg)
+    DELETE_AFTER_CHILDREN(NodeArgs)
+    DELETE_AFTER_CHILDREN(NodeParams)
+    DELETE_AFTER_CHILDREN(NodeBinOp)
+    DELETE_AFTER_CHILDREN(NodeInt)
+    DELETE_AFTER_CHILDREN(NodeDecl)
+    DELETE_AFTER_CHILDREN(NodeDebug)
+    DELETE_AFTER_CHILDREN(NodeIdent)
+    DELETE_AFTER_CHILDREN(NodeFunc)
+    DELETE_AFTER_CHILDREN(NodeCall)
+    DELETE_AFTER_CHILDREN(NodeReturn)
+    DELETE_AFTER_CHILDREN(NodeIfExpr)
+    DELETE_AFTER_CHILDREN(NodePar)
+
+#undef DELETE_AFTER_CHILDREN
+};
+
+void delete_ast(Node *node) {
+    AstDeleter deleter;
+    node->accept(deleter);
+}
@@ -0,0 +1,512 @@
+#include "consteval.hh"
+#include "ast.hh"
+#include "visitor.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+int literal_bits(NodeInt *node) {
+    if(!node->dtype.empty()) {
+        return dtype_bits(node->dtype);
+    }
+    else if(std::abs(node->value) <= 32767) {
+        return 16;
+    }
+    else if(std::abs(node->value) <= 2147483647) {
+        return 32;
+    }
+    return 64;
+}
+
+int dtype_bits(std::string dtype) {
+    if(dtype == "short") {
+        return 16;
+    }
+    else if(dtype == "int") {
+        return 32;
+    }
+    return 64;
+}
+
+std::string bits_dtype(int bits) {
+    if(bits == 16) {
+        return "short";
+    }
+    else if(bits == 32) {
+        return "int";
+    }
+    return "long";
+}
+
+long long wrap_bits(long long value, int bits) {
+    if(bits >= 64) {
+        return value;
+    }
+    unsigned long long mask = (1ULL << bits) - 1;
+    unsigned long long v = (unsigned long long) value & mask;
+    if(v >> (bits - 1)) {
+        v |= ~mask;
+    }
+    return (long long) v;
+}
+
+/**
+    A value during compile time evaluation, with the width codegen would give it.
+*/
+struct ConstValue {
+    long long value;
+    int bits;
+};
+
+// mirrors NodeBinOp::llvm_codegen: both sides are widened to the larger type
+static bool apply_binop(NodeBinOp::Op op, ConstValue l, ConstValue r, ConstValue &out) {
+    out.bits = l.bits > r.bits ? l.bits : r.bits;
+    unsigned long long ul = l.value, ur = r.value;
+    switch(op) {
+        case NodeBinOp::PLUS: out.value = wrap_bits(ul + ur, out.bits); break;
+        case NodeBinOp::MINUS: out.value = wrap_bits(ul - ur, out.bits); break;
+        case NodeBinOp::MULT: out.value = wrap_bits(ul * ur, out.bits); break;
+        case NodeBinOp::DIV:
+            // sdiv by zero and INT_MIN / -1 are undefined, leave them to runtime
+            if(r.value == 0 || (r.value == -1 && l.value == wrap_bits(1ULL << (out.bits - 1), out.bits))) {
+                return false;
+            }
+            out.value = l.value / r.value;
+            break;
+    }
+    return true;
+}
+
+// implicit conversion done by TypeConversion, which rejects narrowing
+static bool convert(ConstValue v, int bits, ConstValue &out) {
+    if(v.bits > bits) {
+        return false;
+    }
+    out.value = v.value;
+    out.bits = bits;
+    return true;
+}
+
+// folds literals and arithmetic on them, anything else is not a constant
+struct ConstantFolder : Visitor {
+    bool constant;
+    ConstValue value;
+
+    ConstantFolder() : constant(false) {}
+
+    using Visitor::visit;
+    void visit(NodeInt *node) {
+        value.value = node->value;
+        value.bits = literal_bits(node);
+        constant = true;
+    }
+    void visit(NodeBinOp *node) {
+        node->left->accept(*this);
+        if(!constant) {
+            return;
+        }
+        ConstValue l = value;
+        node->right->accept(*this);
+        constant = constant && apply_binop(node->op, l, value, value);
+    }
+    void visit(NodeIdent *node) {
+        constant = false;
+    }
+    void visit(NodeCall *node) {
+        constant = false;
+    }
+};
+
+bool fold_constant(Node *node, long long &value, int &bits) {
+    ConstantFolder folder;
+    node->accept(folder);
+    if(!folder.constant) {
+        return false;
+    }
+    value = folder.value.value;
+    bits = folder.value.bits;
+    return true;
+}
+
+bool fold_constant(Node *node, long long &value) {
+    int bits;
+    return fold_constant(node, value, bits);
+}
+
+//  ┌――――――――――――――――――┐  //
+//  │ Purity analysis  │  //
+// └――――――――――――――――――┘   //
+
+PurityAnalysis::PurityAnalysis(NodeStmts *root) {
+    for(auto node : root->list) {
+        if(NodeFunc *func = dynamic_cast<NodeFunc*>(node)) {
+            functions[func->identifier] = func;
+            pure.insert(func->identifier);
+        }
+    }
+
+    // start by assuming everything is pure (so recursion is allowed) and
+    // drop functions until no body depends on an impure one
+    bool changed;
+    do {
+        changed = false;
+        for(auto &i : functions) {
+            if(pure.count(i.first) && !is_pure_expr(i.second->stmtlist)) {
+                pure.erase(i.first);
+                changed = true;
+            }
+        }
+    } while(changed);
+}
+
+// for functions that arrive one at a time: everything `func` calls, other
+// than itself, has been added before, so a single check is enough
+void PurityAnalysis::add(NodeFunc *func) {
+    pure.insert(func->identifier);
+    if(!is_pure_expr(func->stmtlist)) {
+        pure.erase(func->identifier);
+    }
+}
+
+bool PurityAnalysis::is_pure(std::string function) {
+    return pure.count(function) > 0;
+}
+
+// whether the nodes visited neither print nor call a function that may
+struct PurityCheck : Visitor {
+    PurityAnalysis *purity;
+    bool pure;
+
+    PurityCheck(PurityAnalysis *purity) : purity(purity), pure(true) {}
+
+    using Visitor::visit;
+    void visit(NodeDebug *node) {
+        pure = false;
+    }
+    void visit(NodeFunc *node) {
+        pure = false;
+    }
+    void visit(NodeCall *node) {
+        if(!purity->is_pure(node->identifier)) {
+            pure = false;
+            return;
+        }
+        Visitor::visit(node);
+    }
+};
+
+bool PurityAnalysis::is_pure_expr(Node *expr) {
+    PurityCheck check(this);
+    expr->accept(check);
+    return check.pure;
+}
+
+void check_memo(NodeFunc *func, PurityAnalysis *purity) {
+    if((func->attributes & NodeFunc::MEMO) && !purity->is_pure(func->identifier)) {
+        std::cerr << "Error: @memo function " << func->identifier << " is not pure, it prints with dbg or calls a function that does" << std::endl;
+        exit(1);
+    }
+}
+
+void check_memo(NodeStmts *root) {
+    PurityAnalysis purity(root);
+    for(auto node : root->list) {
+        if(NodeFunc *func = dynamic_cast<NodeFunc*>(node)) {
+            check_memo(func, &purity);
+        }
+    }
+}
+
+//  ┌――――――――――――――――――――――――――┐  //
+//  │ Compile time interpreter │  //
+// └――――――――――――――――――――――――――┘   //
+
+/**
+    Interprets pure functions on constant arguments. Every method returns false
+    (or FAILED) when the result cannot be known at compile time, in which case
+    the call is left for codegen.
+*/
+struct Interpreter : Visitor {
+    enum Status {
+        NEXT, RETURNED, FAILED
+    };
+
+    PurityAnalysis *purity;
+    std::list<std::unordered_map<std::string, ConstValue>> scopes;
+    int return_bits;
+    long long steps;
+    int depth;
+
+    // result of the node visited last: FAILED, or NEXT and the value of an
+    // expression, or RETURNED and the value a `ret` returned
+    Status status;
+    ConstValue value;
+
+    Interpreter(PurityAnalysis *purity) : purity(purity), return_bits(64), steps(0), depth(0), status(NEXT) {}
+
+    bool call(NodeFunc *func, std::vector<ConstValue> args, ConstValue &out);
+    bool eval(Node *expr, ConstValue &out);
+    Status exec(Node *stmt, ConstValue &ret);
+
+    using Visitor::visit;
+    void visit(NodeInt *node);
+    void visit(NodeIdent *node);
+    void visit(NodeBinOp *node);
+    void visit(NodeCall *node);
+    void visit(NodeStmts *node);
+    void visit(NodeDecl *node);
+    void visit(NodeReturn *node);
+    void visit(NodeIfExpr *node);
+    void visit(NodeDebug *node);
+    void visit(NodeFunc *node);
+    void visit(NodePar *node);
+};
+
+bool Interpreter::call(NodeFunc *func, std::vector<ConstValue> args, ConstValue &out) {
+    if(depth >= CONSTEVAL_MAX_DEPTH || args.size() != func->arglist->list.size()) {
+        return false;
+    }
+
+    std::unordered_map<std::string, ConstValue> frame;
+    for(size_t i = 0; i < args.size(); i++) {
+        NodeArg *arg = func->arglist->list[i];
+        if(!convert(args[i], dtype_bits(arg->dtype), frame[arg->identifier])) {
+            return false;
+        }
+    }
+
+    std::list<std::unordered_map<std::string, ConstValue>> caller_scopes;
+    caller_scopes.swap(scopes);
+    int caller_return_bits = return_bits;
+    scopes.push_back(frame);
+    return_bits = dtype_bits(func->dtype);
+    depth++;
+
+    ConstValue ret;
+    Status status = exec(func->stmtlist, ret);
+
+    depth--;
+    scopes.swap(caller_scopes);
+    int bits = return_bits;
+    return_bits = caller_return_bits;
+
+    if(status == FAILED) {
+        return false;
+    }
+    if(status == NEXT) {
+        // falling off the end returns 0, see NodeFunc::llvm_codegen
+        ret.value = 0;
+        ret.bits = bits;
+    }
+    out = ret;
+    return true;
+}
+
+bool Interpreter::eval(Node *expr, ConstValue &out) {
+    if(++steps > CONSTEVAL_MAX_STEPS) {
+        status = FAILED;
+        return false;
+    }
+    expr->accept(*this);
+    out = value;
+    return status != FAILED;
+}
+
+Interpreter::Status Interpreter::exec(Node *stmt, ConstValue &ret) {
+    // an expression statement is evaluated for nothing but its failure
+    stmt->accept(*this);
+    if(status == RETURNED) {
+        ret = value;
+    }
+    return status;
+}
+
+void Interpreter::visit(NodeInt *node) {
+    value.value = node->value;
+    value.bits = literal_bits(node);
+    status = NEXT;
+}
+
+void Interpreter::visit(NodeIdent *node) {
+    for(auto i = scopes.rbegin(); i != scopes.rend(); i++) {
+        auto found = i->find(node->identifier);
+        if(found != i->end()) {
+            value = found->second;
+            status = NEXT;
+            return;
+        }
+    }
+    status = FAILED;
+}
+
+void Interpreter::visit(NodeBinOp *node) {
+    ConstValue l, r;
+    bool known = eval(node->left, l) && eval(node->right, r) && apply_binop(node->op, l, r, value);
+    status = known ? NEXT : FAILED;
+}
+
+void Interpreter::visit(NodeCall *node) {
+    status = FAILED;
+    if(!purity->is_pure(node->identifier)) {
+        return;
+    }
+    std::vector<ConstValue> args;
+    for(auto param : node->paramlist->list) {
+        ConstValue arg;
+        if(!eval(param, arg)) {
+            status = FAILED;
+            return;
+        }
+        args.push_back(arg);
+    }
+    status = call(purity->functions[node->identifier], args, value) ? NEXT : FAILED;
+}
+
+void Interpreter::visit(NodeStmts *node) {
+    scopes.push_back(std::unordered_map<std::string, ConstValue>());
+    status = NEXT;
+    for(auto i : node->list) {
+        i->accept(*this);
+        if(status != NEXT) {
+            break;
+        }
+    }
+    scopes.pop_back();
+}
+
+void Interpreter::visit(NodeDecl *node) {
+    ConstValue v;
+    bool known = eval(node->expression, v) && convert(v, dtype_bits(node->dtype), scopes.back()[node->identifier]);
+    status = known ? NEXT : FAILED;
+}
+
+void Interpreter::visit(NodeReturn *node) {
+    ConstValue v;
+    bool known = eval(node->expression, v) && convert(v, return_bits, value);
+    status = known ? RETURNED : FAILED;
+}
+
+void Interpreter::visit(NodeIfExpr *node) {
+    ConstValue cond;
+    if(!eval(node->Cond, cond)) {
+        return;
+    }
+    (cond.value != 0 ? node->Then : node->Else)->accept(*this);
+}
+
+// effects, which compile time evaluation can't have
+void Interpreter::visit(NodeDebug *node) {
+    status = FAILED;
+}
+
+void Interpreter::visit(NodeFunc *node) {
+    status = FAILED;
+}
+
+void Interpreter::visit(NodePar *node) {
+    status = FAILED;
+}
+
+//  ┌――――――――――――――――――――――┐  //
+//  │ Call site replacement │  //
+// └――――――――――――――――――――――┘   //
+
+// replaces calls the interpreter can evaluate by their value
+struct CallFolder : Visitor {
+    PurityAnalysis *purity;
+    // what replaces the node visited last
+    Node *result;
+
+    CallFolder(PurityAnalysis *purity) : purity(purity), result(nullptr) {}
+
+    // returns the node that should replace `node`
+    Node *fold(Node *node) {
+        result = node;
+        node->accept(*this);
+        return result;
+    }
+
+    using Visitor::visit;
+    void visit(NodeStmts *node) {
+        for(auto &i : node->list) {
+            i = fold(i);
+        }
+        result = node;
+    }
+    void visit(NodeFunc *node) {
+        fold(node->stmtlist);
+        result = node;
+    }
+    void visit(NodeIfExpr *node) {
+        node->Cond = fold(node->Cond);
+        node->Then = fold(node->Then);
+        node->Else = fold(node->Else);
+        result = node;
+    }
+    void visit(NodePar *node) {
+        node->lo = fold(node->lo);
+        node->hi = fold(node->hi);
+        fold(node->body);
+        result = node;
+    }
+    void visit(NodeDecl *node) {
+        node->expression = fold(node->expression);
+        result = node;
+    }
+    void visit(NodeDebug *node) {
+        node->expression = fold(node->expression);
+        result = node;
+    }
+    void visit(NodeReturn *node) {
+        node->expression = fold(node->expression);
+        result = node;
+    }
+    void visit(NodeBinOp *node);
+    void visit(NodeCall *node);
+};
+
+void CallFolder::visit(NodeBinOp *node) {
+    node->left = fold(node->left);
+    node->right = fold(node->right);
+    result = node;
+
+    // the operands are folded already, so only literals can make a constant
+    long long value;
+    int bits;
+    if(dynamic_cast<NodeInt*>(node->left) && dynamic_cast<NodeInt*>(node->right) &&
+        fold_constant(node, value, bits)) {
+        result = new NodeInt(value, bits_dtype(bits));
+        delete_ast(node);
+    }
+}
+
+void CallFolder::visit(NodeCall *node) {
+    bool constant_args = true;
+    std::vector<ConstValue> args;
+    for(auto &param : node->paramlist->list) {
+        param = fold(param);
+
+        ConstValue arg;
+        constant_args &= fold_constant(param, arg.value, arg.bits);
+        args.push_back(arg);
+    }
+    result = node;
+
+    ConstValue out;
+    Interpreter interpreter(purity);
+    if(constant_args && purity->is_pure(node->identifier) &&
+        interpreter.call(purity->functions[node->identifier], args, out)) {
+        result = new NodeInt(out.value, bits_dtype(out.bits));
+        delete_ast(node);
+    }
+}
+
+void evaluate_constant_calls(NodeStmts *root) {
+    PurityAnalysis purity(root);
+    CallFolder folder(&purity);
+    folder.fold(root);
+}
@@ -0,0 +1,235 @@
+#include "dce.hh"
+#include "ast.hh"
+#include "consteval.hh"
+#include "visitor.hh"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// whether control can never fall through the statements visited
+struct ReturnCheck : Visitor {
+    bool returns;
+
+    ReturnCheck() : returns(false) {}
+
+    using Visitor::visit;
+    void visit(NodeReturn *node) {
+        returns = true;
+    }
+    void visit(NodeStmts *node) {
+        for(auto i : node->list) {
+            i->accept(*this);
+            if(returns) {
+                return;
+            }
+        }
+    }
+    void visit(NodeIfExpr *node) {
+        node->Then->accept(*this);
+        bool then = returns;
+        returns = false;
+        node->Else->accept(*this);
+        returns = then && returns;
+    }
+    // a function's `ret` leaves the function, not the list it is in, and
+    // `par` bodies can't `ret`
+    void visit(NodeFunc *node) {}
+    void visit(NodePar *node) {}
+};
+
+static bool always_returns(Node *node) {
+    ReturnCheck check;
+    node->accept(check);
+    return check.returns;
+}
+
+// cuts statement lists after their first `ret` and replaces `if`s with
+// constant conditions by the taken branch
+struct Pruner : Visitor {
+    // what replaces the node visited last
+    Node *result;
+
+    // returns the node that should replace `node`
+    Node *prune(Node *node) {
+        result = node;
+        node->accept(*this);
+        return result;
+    }
+
+    // prunes every statement of the list and cuts it after the first `ret`
+    void prune_list(NodeStmts *stmts) {
+        std::vector<Node*> kept;
+        size_t i = 0;
+        while(i < stmts->list.size()) {
+            Node *node = prune(stmts->list[i++]);
+            kept.push_back(node);
+            if(always_returns(node)) {
+                break;
+            }
+        }
+        for(; i < stmts->list.size(); i++) {
+            delete_ast(stmts->list[i]);
+        }
+        stmts->list = kept;
+        result = stmts;
+    }
+
+    using Visitor::visit;
+    void visit(NodeStmts *node) {
+        prune_list(node);
+    }
+    void visit(NodeFunc *node) {
+        prune_list(node->stmtlist);
+        result = node;
+    }
+    void visit(NodeIfExpr *node) {
+        long long cond;
+        if(fold_constant(node->Cond, cond)) {
+            Node *taken = cond != 0 ? node->Then : node->Else;
+            // everything but the taken branch goes
+            if(cond != 0) {
+                node->Then = new NodeStmts();
+            } else {
+                node->Else = new NodeStmts();
+            }
+            delete_ast(node);
+            result = prune(taken);
+            return;
+        }
+        node->Then = prune(node->Then);
+        node->Else = prune(node->Else);
+        result = node;
+    }
+    void visit(NodePar *node) {
+        prune_list(node->body);
+        result = node;
+    }
+    // expressions hold no statements
+    void visit(NodeDecl *node) {}
+    void visit(NodeDebug *node) {}
+    void visit(NodeReturn *node) {}
+    void visit(NodeBinOp *node) {}
+    void visit(NodeCall *node) {}
+};
+
+static void prune_list(NodeStmts *stmts) {
+    Pruner pruner;
+    pruner.prune_list(stmts);
+}
+
+// removes unread pure `let`s from the blocks visited, functions are handled
+// separately with their own use counts
+struct UnusedDecls : Visitor {
+    std::unordered_map<std::string, int> &uses;
+    PurityAnalysis *purity;
+    bool changed;
+
+    UnusedDecls(std::unordered_map<std::string, int> &uses, PurityAnalysis *purity) :
+        uses(uses), purity(purity), changed(false) {}
+
+    using Visitor::visit;
+    void visit(NodeStmts *node) {
+        std::vector<Node*> kept;
+        for(auto i : node->list) {
+            NodeDecl *decl = dynamic_cast<NodeDecl*>(i);
+            if(decl && uses[decl->identifier] == 0 && purity->is_pure_expr(decl->expression)) {
+                delete_ast(decl);
+                changed = true;
+                continue;
+            }
+            i->accept(*this);
+            kept.push_back(i);
+        }
+        node->list = kept;
+    }
+    void visit(NodeIfExpr *node) {
+        node->Then->accept(*this);
+        node->Else->accept(*this);
+    }
+    void visit(NodeFunc *node) {}
+    // expressions hold no `let`s
+    void visit(NodeDecl *node) {}
+    void visit(NodeDebug *node) {}
+    void visit(NodeReturn *node) {}
+    void visit(NodeBinOp *node) {}
+    void visit(NodeCall *node) {}
+};
+
+// removing a `let` can make the ones it read from unused, so repeat until stable
+static void remove_unused_decls(NodeStmts *scope, Node *counted, PurityAnalysis *purity) {
+    bool changed;
+    do {
+        std::vector<std::string> names;
+        collect_identifiers(counted, names);
+        std::unordered_map<std::string, int> uses;
+        for(auto &name : names) {
+            uses[name]++;
+        }
+        UnusedDecls remover(uses, purity);
+        scope->accept(remover);
+        changed = remover.changed;
+    } while(changed);
+}
+
+// drops top level functions that `main` can never call
+static void remove_unreachable_functions(NodeStmts *root) {
+    std::unordered_map<std::string, NodeFunc*> funcs;
+    for(auto node : root->list) {
+        if(NodeFunc *func = dynamic_cast<NodeFunc*>(node)) {
+            funcs[func->identifier] = func;
+        }
+    }
+    if(funcs.find("main") == funcs.end()) {
+        return;
+    }
+
+    std::unordered_set<std::string> reachable = {"main"};
+    std::vector<std::string> worklist = {"main"};
+    while(!worklist.empty()) {
+        NodeFunc *func = funcs[worklist.back()];
+        worklist.pop_back();
+
+        std::vector<std::string> callees;
+        collect_calls(func->stmtlist, callees);
+        for(auto &callee : callees) {
+            if(funcs.count(callee) && reachable.insert(callee).second) {
+                worklist.push_back(callee);
+            }
+        }
+    }
+
+    std::vector<Node*> kept;
+    for(auto node : root->list) {
+        NodeFunc *func = dynamic_cast<NodeFunc*>(node);
+        if(!func || reachable.count(func->identifier)) {
+            kept.push_back(node);
+        } else {
+            delete_ast(func);
+        }
+    }
+    root->list = kept;
+}
+
+void eliminate_dead_code(NodeStmts *root) {
+    prune_list(root);
+
+    PurityAnalysis purity(root);
+    for(auto node : root->list) {
+        if(NodeFunc *func = dynamic_cast<NodeFunc*>(node)) {
+            remove_unused_decls(func->stmtlist, func->stmtlist, &purity);
+        }
+    }
+
+    // top level `let`s can be read from anywhere in the program
+    remove_unused_decls(root, root, &purity);
+
+    // after the `let`s, whose calls may have been the only ones
+    remove_unreachable_functions(root);
+}
+
+void eliminate_dead_code(NodeFunc *func, PurityAnalysis *purity) {
+    prune_list(func->stmtlist);
+    remove_unused_decls(func->stmtlist, func->stmtlist, purity);
+}
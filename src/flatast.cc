@@ -0,0 +1,387 @@
+#include "flatast.hh"
+#include "ast.hh"
+#include "llvmcodegen.hh"
+#include "visitor.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <llvm/Support/raw_ostream.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define AST_BENCHMARK_RUNS 5
+
+//  ┌――――――――――――┐  //
+//  │ Flattening │  //
+// └――――――――――――┘   //
+
+uint32_t FlatAst::intern(std::string s) {
+    auto found = string_ids.find(s);
+    if(found == string_ids.end()) {
+        found = string_ids.insert({s, (uint32_t) strings.size()}).first;
+        strings.push_back(s);
+    }
+    return found->second;
+}
+
+uint16_t FlatAst::intern_dtype(std::string s) {
+    // only a few types, a search is as fast as a map
+    for(size_t i = 0; i < dtypes.size(); i++) {
+        if(dtypes[i] == s) {
+            return i;
+        }
+    }
+    if(dtypes.size() > UINT16_MAX) {
+        std::cerr << "Error: too many types for the flat AST" << std::endl;
+        exit(1);
+    }
+    dtypes.push_back(s);
+    return dtypes.size() - 1;
+}
+
+// children go in first, so a node always comes after everything below it
+NodeRef FlatAst::add(Node *node) {
+    FlatNode flat = {(uint8_t) node->type, 0, 0, 0, 0, 0};
+    std::vector<NodeRef> children;
+
+    switch(node->type) {
+        case Node::STMTS:
+            for(auto i : ((NodeStmts*) node)->list) {
+                children.push_back(add(i));
+            }
+            break;
+        case Node::ARGS:
+            for(auto i : ((NodeArgs*) node)->list) {
+                children.push_back(add(i));
+            }
+            break;
+        case Node::PARAMS:
+            for(auto i : ((NodeParams*) node)->list) {
+                children.push_back(add(i));
+            }
+            break;
+        case Node::ARG: {
+            NodeArg *arg = (NodeArg*) node;
+            flat.a = intern(arg->identifier);
+            flat.dtype = intern_dtype(arg->dtype);
+            break;
+        }
+        case Node::FUNC: {
+            NodeFunc *func = (NodeFunc*) node;
+            flat.a = intern(func->identifier);
+            flat.b = add(func->stmtlist);
+            flat.c = add(func->arglist);
+            flat.dtype = intern_dtype(func->dtype);
+            flat.op = func->attributes;
+            break;
+        }
+        case Node::ASSN: {
+            NodeDecl *decl = (NodeDecl*) node;
+            flat.a = intern(decl->identifier);
+            flat.b = add(decl->expression);
+            flat.dtype = intern_dtype(decl->dtype);
+            break;
+        }
+        case Node::DBG:
+            flat.a = add(((NodeDebug*) node)->expression);
+            break;
+        case Node::RET:
+            flat.a = add(((NodeReturn*) node)->expression);
+            break;
+        case Node::IF: {
+            NodeIfExpr *ifexpr = (NodeIfExpr*) node;
+            flat.a = add(ifexpr->Cond);
+            flat.b = add(ifexpr->Then);
+            flat.c = add(ifexpr->Else);
+            break;
+        }
+        case Node::PAR: {
+            NodePar *par = (NodePar*) node;
+            FlatNode bounds = {(uint8_t) Node::PARAMS, 0, 0, 0, 2, 0};
+            NodeRef lo = add(par->lo);
+            NodeRef hi = add(par->hi);
+            bounds.a = lists.size();
+            lists.push_back(lo);
+            lists.push_back(hi);
+            nodes.push_back(bounds);
+            flat.c = nodes.size() - 1;
+            flat.a = intern(par->identifier);
+            flat.b = add(par->body);
+            flat.dtype = intern_dtype(par->dtype);
+            break;
+        }
+        case Node::BIN_OP: {
+            NodeBinOp *binop = (NodeBinOp*) node;
+            flat.op = binop->op;
+            flat.a = add(binop->left);
+            flat.b = add(binop->right);
+            break;
+        }
+        case Node::INT_LIT: {
+            NodeInt *lit = (NodeInt*) node;
+            flat.a = ints.size();
+            ints.push_back(lit->value);
+            flat.dtype = intern_dtype(lit->dtype);
+            break;
+        }
+        case Node::IDENT:
+            flat.a = intern(((NodeIdent*) node)->identifier);
+            break;
+        case Node::CALL: {
+            NodeCall *call = (NodeCall*) node;
+            flat.a = intern(call->identifier);
+            flat.b = add(call->paramlist);
+            break;
+        }
+    }
+
+    if(node->type == Node::STMTS || node->type == Node::ARGS || node->type == Node::PARAMS) {
+        flat.a = lists.size();
+        flat.b = children.size();
+        lists.insert(lists.end(), children.begin(), children.end());
+    }
+
+    nodes.push_back(flat);
+    return nodes.size() - 1;
+}
+
+FlatAst flatten(NodeStmts *root) {
+    FlatAst ast;
+    // an empty string always has id 0, and so does the dtype of nodes without one
+    ast.intern("");
+    ast.intern_dtype("");
+    ast.root = ast.add(root);
+
+    // only needed while building
+    std::unordered_map<std::string, uint32_t>().swap(ast.string_ids);
+    ast.nodes.shrink_to_fit();
+    ast.lists.shrink_to_fit();
+    ast.ints.shrink_to_fit();
+    return ast;
+}
+
+//  ┌――――――――――――――――――┐  //
+//  │ Memory footprint │  //
+// └――――――――――――――――――┘   //
+
+// bytes the allocator really hands out for a block, header included
+static size_t heap_bytes(const void *block, size_t size) {
+    if(!block || !size) {
+        return 0;
+    }
+#ifdef __GLIBC__
+    return malloc_usable_size((void*) block) + sizeof(size_t);
+#else
+    return size;
+#endif
+}
+
+static size_t string_bytes(const std::string &s) {
+    // short strings live inside the object
+    const char *data = s.data();
+    if(data >= (const char*) &s && data < (const char*) (&s + 1)) {
+        return 0;
+    }
+    return heap_bytes(data, s.capacity() + 1);
+}
+
+template <typename T>
+static size_t vector_bytes(const std::vector<T> &v) {
+    return heap_bytes(v.data(), v.capacity() * sizeof(T));
+}
+
+size_t FlatAst::bytes() {
+    size_t total = vector_bytes(nodes) + vector_bytes(lists) + vector_bytes(ints) + vector_bytes(strings)
+        + vector_bytes(dtypes);
+    for(auto &s : strings) {
+        total += string_bytes(s);
+    }
+    for(auto &s : dtypes) {
+        total += string_bytes(s);
+    }
+    return total;
+}
+
+// memory of the pointer tree, every node is its own allocation
+struct TreeBytes : Visitor {
+    size_t total = 0;
+
+    void visit(NodeStmts *node) { total += heap_bytes(node, sizeof(*node)) + vector_bytes(node->list); Visitor::visit(node); }
+    void visit(NodeArg *node) { total += heap_bytes(node, sizeof(*node)) + string_bytes(node->identifier) + string_bytes(node->dtype); }
+    void visit(NodeArgs *node) { total += heap_bytes(node, sizeof(*node)) + vector_bytes(node->list); Visitor::visit(node); }
+    void visit(NodeParams *node) { total += heap_bytes(node, sizeof(*node)) + vector_bytes(node->list); Visitor::visit(node); }
+    void visit(NodeBinOp *node) { total += heap_bytes(node, sizeof(*node)); Visitor::visit(node); }
+    void visit(NodeInt *node) { total += heap_bytes(node, sizeof(*node)) + string_bytes(node->dtype); }
+    void visit(NodeDecl *node) { total += heap_bytes(node, sizeof(*node)) + string_bytes(node->identifier) + string_bytes(node->dtype); Visitor::visit(node); }
+    void visit(NodeDebug *node) { total += heap_bytes(node, sizeof(*node)); Visitor::visit(node); }
+    void visit(NodeIdent *node) { total += heap_bytes(node, sizeof(*node)) + string_bytes(node->identifier); }
+    void visit(NodeFunc *node) { total += heap_bytes(node, sizeof(*node)) + string_bytes(node->identifier) + string_bytes(node->dtype); Visitor::visit(node); }
+    void visit(NodeCall *node) { total += heap_bytes(node, sizeof(*node)) + string_bytes(node->identifier); Visitor::visit(node); }
+    void visit(NodeReturn *node) { total += heap_bytes(node, sizeof(*node)); Visitor::visit(node); }
+    void visit(NodeIfExpr *node) { total += heap_bytes(node, sizeof(*node)); Visitor::visit(node); }
+    void visit(NodePar *node) { total += heap_bytes(node, sizeof(*node)) + string_bytes(node->identifier) + string_bytes(node->dtype); Visitor::visit(node); }
+};
+
+//  ┌―――――――――――┐  //
+//  │ Benchmark │  //
+// └―――――――――――┘   //
+
+/*
+Both traversals visit every node and fold the same summary of the tree, so
+their results also show that the flat copy is complete.
+*/
+
+struct TreeSummary : Visitor {
+    unsigned long long hash = 0;
+
+    void mix(unsigned long long value) { hash = (hash ^ value) * 1099511628211ULL; }
+
+    void visit(NodeStmts *node) { mix(Node::STMTS); Visitor::visit(node); }
+    void visit(NodeArg *node) { mix(Node::ARG); mix(node->identifier.size()); }
+    void visit(NodeArgs *node) { mix(Node::ARGS); Visitor::visit(node); }
+    void visit(NodeParams *node) { mix(Node::PARAMS); Visitor::visit(node); }
+    void visit(NodeBinOp *node) { mix(Node::BIN_OP); mix(node->op); Visitor::visit(node); }
+    void visit(NodeInt *node) { mix(Node::INT_LIT); mix(node->value); }
+    void visit(NodeDecl *node) { mix(Node::ASSN); mix(node->identifier.size()); Visitor::visit(node); }
+    void visit(NodeDebug *node) { mix(Node::DBG); Visitor::visit(node); }
+    void visit(NodeIdent *node) { mix(Node::IDENT); mix(node->identifier.size()); }
+    void visit(NodeFunc *node) { mix(Node::FUNC); mix(node->identifier.size()); Visitor::visit(node); }
+    void visit(NodeCall *node) { mix(Node::CALL); mix(node->identifier.size()); Visitor::visit(node); }
+    void visit(NodeReturn *node) { mix(Node::RET); Visitor::visit(node); }
+    void visit(NodeIfExpr *node) { mix(Node::IF); Visitor::visit(node); }
+    void visit(NodePar *node) { mix(Node::PAR); mix(node->identifier.size()); Visitor::visit(node); }
+};
+
+static void flat_summary(FlatAst &ast, NodeRef ref, unsigned long long &hash) {
+    auto mix = [&](unsigned long long value) { hash = (hash ^ value) * 1099511628211ULL; };
+    FlatNode &node = ast[ref];
+    mix(node.type);
+
+    switch(node.type) {
+        case Node::STMTS:
+        case Node::ARGS:
+        case Node::PARAMS:
+            for(NodeRef *i = ast.list_begin(node); i != ast.list_end(node); i++) {
+                flat_summary(ast, *i, hash);
+            }
+            break;
+        case Node::ARG:
+        case Node::IDENT:
+            mix(ast.strings[node.a].size());
+            break;
+        case Node::FUNC:
+            mix(ast.strings[node.a].size());
+            flat_summary(ast, node.c, hash);
+            flat_summary(ast, node.b, hash);
+            break;
+        case Node::ASSN:
+            mix(ast.strings[node.a].size());
+            flat_summary(ast, node.b, hash);
+            break;
+        case Node::DBG:
+        case Node::RET:
+            flat_summary(ast, node.a, hash);
+            break;
+        case Node::IF:
+            flat_summary(ast, node.a, hash);
+            flat_summary(ast, node.b, hash);
+            flat_summary(ast, node.c, hash);
+            break;
+        case Node::PAR: {
+            mix(ast.strings[node.a].size());
+            FlatNode &bounds = ast[node.c];
+            for(NodeRef *i = ast.list_begin(bounds); i != ast.list_end(bounds); i++) {
+                flat_summary(ast, *i, hash);
+            }
+            flat_summary(ast, node.b, hash);
+            break;
+        }
+        case Node::BIN_OP:
+            mix(node.op);
+            flat_summary(ast, node.a, hash);
+            flat_summary(ast, node.b, hash);
+            break;
+        case Node::INT_LIT:
+            mix(ast.ints[node.a]);
+            break;
+        case Node::CALL:
+            mix(ast.strings[node.a].size());
+            flat_summary(ast, node.b, hash);
+            break;
+    }
+}
+
+// best time in milliseconds of a few runs of `run`
+template <typename F>
+static double best_time(int runs, F run) {
+    double best = 0;
+    for(int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if(i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+static std::string generate_ir(NodeStmts *root, FlatAst *flat) {
+    LLVMContext context;
+    LLVMCompiler compiler(&context, "base");
+    compiler.debug = false;
+    if(flat) {
+        compiler.compile_flat(*flat);
+    } else {
+        compiler.compile(root);
+    }
+
+    std::string ir;
+    raw_string_ostream out(ir);
+    out << compiler.module;
+    return out.str();
+}
+
+void ast_benchmark(NodeStmts *root) {
+    FlatAst flat = flatten(root);
+
+    TreeSummary tree_summary;
+    root->accept(tree_summary);
+    unsigned long long flat_hash = 0;
+    flat_summary(flat, flat.root, flat_hash);
+    if(tree_summary.hash != flat_hash) {
+        std::cerr << "Error: flat AST does not match the pointer tree" << std::endl;
+        exit(1);
+    }
+    if(generate_ir(root, nullptr) != generate_ir(root, &flat)) {
+        std::cerr << "Error: flat AST codegen differs from the pointer tree" << std::endl;
+        exit(1);
+    }
+
+    TreeBytes tree_bytes;
+    root->accept(tree_bytes);
+
+    double flatten_ms = best_time(AST_BENCHMARK_RUNS, [&]() { flatten(root); });
+    double tree_walk_ms = best_time(AST_BENCHMARK_RUNS, [&]() {
+        TreeSummary summary;
+        root->accept(summary);
+    });
+    double flat_walk_ms = best_time(AST_BENCHMARK_RUNS, [&]() {
+        unsigned long long hash = 0;
+        flat_summary(flat, flat.root, hash);
+    });
+    double tree_codegen_ms = best_time(AST_BENCHMARK_RUNS, [&]() { generate_ir(root, nullptr); });
+    double flat_codegen_ms = best_time(AST_BENCHMARK_RUNS, [&]() { generate_ir(root, &flat); });
+
+    printf("nodes: %zu, identical traversal and IR\n", flat.nodes.size());
+    printf("%-10s %12s %12s %12s\n", "", "memory", "traversal", "codegen");
+    printf("%-10s %9.2f MB %9.2f ms %9.2f ms\n", "pointer", tree_bytes.total / 1e6, tree_walk_ms, tree_codegen_ms);
+    printf("%-10s %9.2f MB %9.2f ms %9.2f ms\n", "flat", flat.bytes() / 1e6, flat_walk_ms, flat_codegen_ms);
+    printf("flattening: %.2f ms\n", flatten_ms);
+}
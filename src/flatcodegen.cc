@@ -0,0 +1,166 @@
+#include "llvmcodegen.hh"
+#include "flatast.hh"
+
+#include <string>
+#include <vector>
+
+/*
+Codegen for the flat AST, one switch over the node type instead of a virtual
+call per node. It only decodes the nodes, the IR is emitted by the same
+`LLVMCompiler` methods `llvm_codegen` on the pointer tree calls, so both
+produce exactly the same IR.
+*/
+
+struct FlatCodegen {
+    FlatAst &ast;
+    LLVMCompiler *compiler;
+
+    FlatCodegen(FlatAst &ast, LLVMCompiler *compiler) : ast(ast), compiler(compiler) {}
+
+    Value *gen(NodeRef ref);
+    Value *gen_func(FlatNode &node);
+    Value *gen_call(FlatNode &node);
+    Value *gen_if(FlatNode &node);
+    Value *gen_par(FlatNode &node);
+    void identifiers(NodeRef ref, std::vector<std::string> &names);
+};
+
+Value *FlatCodegen::gen(NodeRef ref) {
+    FlatNode &node = ast[ref];
+
+    switch(node.type) {
+        case Node::STMTS: {
+            compiler->symbols.scope();
+            Value *last = nullptr;
+            for(NodeRef *i = ast.list_begin(node); i != ast.list_end(node); i++) {
+                last = gen(*i);
+            }
+            compiler->symbols.unscope();
+            return last;
+        }
+        case Node::DBG:
+            return compiler->emit_debug(gen(node.a));
+        case Node::INT_LIT:
+            return compiler->emit_int(ast.ints[node.a], ast.dtypes[node.dtype]);
+        case Node::BIN_OP: {
+            Value *left = gen(node.a);
+            Value *right = gen(node.b);
+            return CreateBinOp(node.op, left, right, compiler);
+        }
+        case Node::ASSN: {
+            Value *expr = gen(node.b);
+            return compiler->emit_decl(ast.strings[node.a], ast.dtypes[node.dtype], expr);
+        }
+        case Node::IDENT:
+            return compiler->emit_load(ast.strings[node.a]);
+        case Node::FUNC:
+            return gen_func(node);
+        case Node::CALL:
+            return gen_call(node);
+        case Node::RET:
+            return compiler->emit_return(gen(node.a));
+        case Node::IF:
+            return gen_if(node);
+        case Node::PAR:
+            return gen_par(node);
+    }
+    // ARG, ARGS and PARAMS are only read by their parents
+    return nullptr;
+}
+
+Value *FlatCodegen::gen_func(FlatNode &node) {
+    FlatNode &args = ast[node.c];
+    std::vector<std::string> arg_names, arg_dtypes;
+    for(NodeRef *i = ast.list_begin(args); i != ast.list_end(args); i++) {
+        arg_names.push_back(ast.strings[ast[*i].a]);
+        arg_dtypes.push_back(ast.dtypes[ast[*i].dtype]);
+    }
+
+    Function *func = compiler->begin_func(ast.strings[node.a], ast.dtypes[node.dtype], arg_names, arg_dtypes, node.op);
+    Value *r = gen(node.b);
+    compiler->end_func(func, node.op);
+    return r;
+}
+
+Value *FlatCodegen::gen_call(FlatNode &node) {
+    FlatNode &params = ast[node.b];
+    Function *callee = compiler->callee(ast.strings[node.a], params.b);
+    std::vector<Value*> args;
+    NodeRef *param = ast.list_begin(params);
+    for(auto &i : callee->args()) {
+        args.push_back(TypeConversion(gen(*param++), i.getType(), compiler));
+    }
+    return compiler->builder.CreateCall(callee, args, "calltmp");
+}
+
+Value *FlatCodegen::gen_if(FlatNode &node) {
+    Value *cond = gen(node.a);
+    if(!cond) {
+        return nullptr;
+    }
+
+    IfBlocks blocks = compiler->begin_if(cond);
+    Value *then_v = gen(node.b);
+    compiler->begin_else(blocks);
+    gen(node.c);
+    compiler->end_if(blocks);
+    return then_v;
+}
+
+// the identifiers under `ref` in evaluation order, like `collect_identifiers` finds them
+void FlatCodegen::identifiers(NodeRef ref, std::vector<std::string> &names) {
+    FlatNode &node = ast[ref];
+    switch(node.type) {
+        case Node::STMTS:
+        case Node::PARAMS:
+            for(NodeRef *i = ast.list_begin(node); i != ast.list_end(node); i++) {
+                identifiers(*i, names);
+            }
+            break;
+        case Node::IDENT:
+            names.push_back(ast.strings[node.a]);
+            break;
+        case Node::FUNC:
+        case Node::ASSN:
+        case Node::CALL:
+            identifiers(node.b, names);
+            break;
+        case Node::DBG:
+        case Node::RET:
+            identifiers(node.a, names);
+            break;
+        case Node::IF:
+            identifiers(node.a, names);
+            identifiers(node.b, names);
+            identifiers(node.c, names);
+            break;
+        case Node::BIN_OP:
+            identifiers(node.a, names);
+            identifiers(node.b, names);
+            break;
+        case Node::PAR:
+            identifiers(node.c, names);
+            identifiers(node.b, names);
+            break;
+    }
+}
+
+Value *FlatCodegen::gen_par(FlatNode &node) {
+    FlatNode &bounds = ast[node.c];
+    Value *lo = gen(ast.list_begin(bounds)[0]);
+    Value *hi = gen(ast.list_begin(bounds)[1]);
+
+    std::vector<std::string> names;
+    identifiers(node.b, names);
+    ParLoop loop = compiler->begin_par(ast.strings[node.a], ast.dtypes[node.dtype], lo, hi, names);
+    gen(node.b);
+    compiler->end_par(loop);
+    return nullptr;
+}
+
+void LLVMCompiler::compile_flat(FlatAst &ast) {
+    declare_runtime();
+    symbols.scope();
+    FlatCodegen codegen(ast, this);
+    codegen.gen(ast.root);
+}
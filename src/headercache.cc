@@ -0,0 +1,133 @@
+#include "headercache.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+long long file_mtime(std::string path) {
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) {
+        return -1;
+    }
+    // nanoseconds, so that edits within the same second are noticed
+#ifdef __APPLE__
+    return st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+}
+
+// strings are stored length prefixed, macro values may contain anything
+static void put(std::ostream &out, const std::string &s) {
+    out << s.size() << ' ' << s;
+}
+
+static bool get(std::istream &in, std::string &s) {
+    size_t size;
+    if(!(in >> size) || in.get() != ' ') {
+        return false;
+    }
+    s.resize(size);
+    in.read(&s[0], size);
+    return (bool) in;
+}
+
+std::string HeaderCache::make_key(std::string path, long long mtime,
+    std::unordered_map<std::string, std::string> &macros, std::set<std::string> &included) {
+    std::ostringstream key;
+    put(key, path);
+    key << mtime << ' ';
+
+    // unordered_map iteration order is not stable, sort the macros first
+    std::vector<std::pair<std::string, std::string>> sorted(macros.begin(), macros.end());
+    std::sort(sorted.begin(), sorted.end());
+    key << sorted.size() << ' ';
+    for(auto &i : sorted) {
+        put(key, i.first);
+        put(key, i.second);
+    }
+
+    key << included.size() << ' ';
+    for(auto &i : included) {
+        put(key, i);
+    }
+    return key.str();
+}
+
+static std::string entry_path(std::string dir, std::string key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016zx.hdr", std::hash<std::string>()(key));
+    return dir + "/" + name;
+}
+
+bool HeaderCache::lookup(std::string key, HeaderCacheEntry &entry) {
+    std::ifstream in(entry_path(dir, key), std::ios::binary);
+    std::string stored_key;
+    // different keys can share a file name, so the key is stored too
+    if(!in || !get(in, stored_key) || stored_key != key) {
+        return false;
+    }
+
+    size_t count;
+    if(!(in >> count)) {
+        return false;
+    }
+    entry.deps.clear();
+    for(size_t i = 0; i < count; i++) {
+        HeaderDep dep;
+        if(!get(in, dep.path) || !(in >> dep.mtime) || file_mtime(dep.path) != dep.mtime) {
+            return false;
+        }
+        entry.deps.push_back(dep);
+    }
+
+    if(!(in >> count)) {
+        return false;
+    }
+    entry.macros.clear();
+    for(size_t i = 0; i < count; i++) {
+        std::string name, value;
+        if(!get(in, name) || !get(in, value)) {
+            return false;
+        }
+        entry.macros[name] = value;
+    }
+
+    return get(in, entry.text);
+}
+
+void HeaderCache::store(std::string key, HeaderCacheEntry &entry) {
+    mkdir(dir.c_str(), 0755);
+
+    // written to a temporary first so a concurrent build never reads half an entry
+    std::string path = entry_path(dir, key);
+    std::string temp_path = path + "." + std::to_string(getpid());
+    std::ofstream out(temp_path, std::ios::binary);
+    put(out, key);
+
+    out << entry.deps.size() << ' ';
+    for(auto &dep : entry.deps) {
+        put(out, dep.path);
+        out << dep.mtime << ' ';
+    }
+
+    out << entry.macros.size() << ' ';
+    for(auto &i : entry.macros) {
+        put(out, i.first);
+        put(out, i.second);
+    }
+
+    put(out, entry.text);
+    out.close();
+
+    // the cache is only an optimization, failing to write it is not an error
+    if(!out || rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+    }
+}
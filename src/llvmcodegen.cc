@@ -1,5 +1,6 @@
 #include "llvmcodegen.hh"
 #include "ast.hh"
+#include "visitor.hh"
 #include <iostream>
 #include <string>
 #include <llvm/Support/FileSystem.h>
@@ -11,7 +12,14 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/GlobalValue.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <algorithm>
+#include <mutex>
 #include <vector>
 
 #define MAIN_FUNC compiler->module.getFunction("main")
@@ -22,9 +30,10 @@ ins `docs/llvm.md`
 */
 AllocaInst* SymbolsTable::find(std::string key) {
     AllocaInst* found = nullptr;
-    for(auto i : table) {
-        if(i.find(key) != i.end()) {
-            found = i[key];
+    for(auto &i : table) {
+        auto entry = i.find(key);
+        if(entry != i.end()) {
+            found = entry->second;
             break;
         }
     }
@@ -47,7 +56,27 @@ void SymbolsTable::unscope() {
     table.pop_front();
 }
 
+// the codegen of several modules can run at once, keep their lines whole
+static std::mutex debug_mutex;
+
+void debug_log(LLVMCompiler *compiler, std::string line) {
+    if(!compiler->debug) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(debug_mutex);
+    std::cout << line << std::endl;
+}
+
 void LLVMCompiler::compile(Node *root) {
+    declare_runtime();
+    symbols.scope();
+    root->llvm_codegen(this);
+
+    // // return 0;
+    // builder.CreateRet(builder.getInt32(0));
+}
+
+void LLVMCompiler::declare_runtime() {
     /* Adding reference to print_i in the runtime library */
     // void printi();
     FunctionType *printi_func_type = FunctionType::get(
@@ -64,30 +93,374 @@ void LLVMCompiler::compile(Node *root) {
     /* we can get this later 
         module.getFunction("printi");
     */
+}
+
+// left to the linker, they share state across the whole program: the thread
+// pool, and the memo tables reported at exit
+static const char *process_runtime[] = {"be_parallel_for", "be_memo_lookup", "be_memo_store"};
+
+/*
+Links in the definitions of the runtime functions the module declares, so the
+inliner sees `printi`. They become internal, and are generated for the same CPU
+as the rest of the module, which the inliner requires. The ones in
+`process_runtime` stay declarations.
+*/
+void LLVMCompiler::link_runtime() {
+    if(runtime.empty()) {
+        return;
+    }
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(runtime);
+    if(!buffer) {
+        std::cerr << "Error: could not read " << runtime << ": " << buffer.getError().message() << std::endl;
+        exit(1);
+    }
+    Expected<std::unique_ptr<Module>> library = parseBitcodeFile((*buffer)->getMemBufferRef(), *context);
+    if(!library) {
+        std::cerr << "Error: could not read " << runtime << ": " << toString(library.takeError()) << std::endl;
+        exit(1);
+    }
+
+    for(auto name : process_runtime) {
+        if(Function *func = (*library)->getFunction(name)) {
+            func->deleteBody();
+        }
+    }
+    for(auto &func : **library) {
+        func.removeFnAttr("target-cpu");
+        func.removeFnAttr("target-features");
+        func.removeFnAttr("tune-cpu");
+        if(func.isDeclaration()) {
+            continue;
+        }
+        set_target_attributes(&func);
+        // e.g. TBAA, the rest of the module has none to go with it
+        for(auto &block : func) {
+            for(auto &instruction : block) {
+                instruction.dropUnknownNonDebugMetadata();
+            }
+        }
+    }
+    StripDebugInfo(**library);
+
+    bool failed = Linker::linkModules(module, std::move(*library), Linker::LinkOnlyNeeded,
+        [](Module &linked, const StringSet<> &names) {
+            for(auto &name : names) {
+                if(GlobalValue *global = linked.getNamedValue(name.first())) {
+                    global->setLinkage(GlobalValue::InternalLinkage);
+                }
+            }
+        });
+    if(failed) {
+        std::cerr << "Error: could not link " << runtime << std::endl;
+        exit(1);
+    }
+}
+
+// declaration of `func`, created the first time it is asked for
+Function *LLVMCompiler::declare(NodeFunc *func) {
+    std::vector<std::string> arg_dtypes;
+    for (auto i: func->arglist->list) {
+        arg_dtypes.push_back(i->dtype);
+    }
+    return declare(func->identifier, func->dtype, arg_dtypes);
+}
+
+Function *LLVMCompiler::declare(std::string identifier, std::string dtype, const std::vector<std::string> &arg_dtypes) {
+    Function *existing = module.getFunction(identifier);
+    if(existing) {
+        return existing;
+    }
+
+    std::vector<Type*> argsT;
+    for (auto &i: arg_dtypes) {
+        argsT.push_back(gType(i, this));
+    }
+    FunctionType *func_type = FunctionType::get(
+        gType(dtype, this), argsT, false /* is vararg */
+    );
+
+    return Function::Create(
+        func_type,
+        GlobalValue::ExternalLinkage,
+        identifier,
+        &module
+    );
+}
+
+/*
+The body of a `par` loop is outlined into an internal task function
+`void <function>.par(i64 lo, i64 hi, i8* env)` that runs the iterations in
+[lo, hi), and the loop itself becomes a call to `be_parallel_for` in the
+runtime, which splits the range over its threads. The variables of `names`
+that are in scope here are copied into an `env` struct, and loaded back into
+variables of the task, so the body sees the values they had when the loop
+started. Codegen continues in the task's loop body until `end_par`.
+*/
+ParLoop LLVMCompiler::begin_par(std::string identifier, std::string dtype, Value *lo, Value *hi,
+    const std::vector<std::string> &names) {
+    ParLoop loop;
+    Type *ty = gType(dtype, this);
+    Type *i64 = builder.getInt64Ty();
+    PointerType *i8_ptr = builder.getInt8PtrTy();
+    Range index_range = range_index(range(lo), range(hi));
+    loop.lo = builder.CreateIntCast(TypeConversion(lo, ty, this), i64, true);
+    loop.hi = builder.CreateIntCast(TypeConversion(hi, ty, this), i64, true);
+
+    std::vector<std::string> captured;
+    std::vector<AllocaInst*> variables;
+    std::vector<Type*> fields;
+    for(auto &name : names) {
+        AllocaInst *alloca = symbols.find(name);
+        if(!alloca || name == identifier || std::find(captured.begin(), captured.end(), name) != captured.end()) {
+            continue;
+        }
+        captured.push_back(name);
+        variables.push_back(alloca);
+        fields.push_back(alloca->getAllocatedType());
+    }
+
+    Function *caller = builder.GetInsertBlock()->getParent();
+    StructType *env_type = nullptr;
+    loop.env = ConstantPointerNull::get(i8_ptr);
+    if(!captured.empty()) {
+        env_type = StructType::get(*context, fields);
+        AllocaInst *env = CreateEntryBlockAlloca(caller, "par.env", env_type);
+        for(size_t i = 0; i < captured.size(); i++) {
+            Value *value = builder.CreateLoad(fields[i], variables[i], captured[i]);
+            builder.CreateStore(value, builder.CreateStructGEP(env_type, env, i));
+        }
+        loop.env = builder.CreateBitCast(env, i8_ptr);
+    }
+
+    FunctionType *task_type = FunctionType::get(builder.getVoidTy(), {i64, i64, i8_ptr}, false);
+    loop.task = Function::Create(task_type, GlobalValue::InternalLinkage, caller->getName() + ".par", &module);
+    set_target_attributes(loop.task);
+    loop.task->getArg(0)->setName("lo");
+    loop.task->getArg(1)->setName("hi");
+    loop.task->getArg(2)->setName("env");
+    debug_log(this, "DEBUG: outlining par loop into " + loop.task->getName().str());
+
+    loop.caller = builder.GetInsertBlock();
+    std::swap(loop.caller_symbols.table, symbols.table);
     symbols.scope();
-    root->llvm_codegen(this);
 
-    // // return 0;
-    // builder.CreateRet(builder.getInt32(0));
+    BasicBlock *entry = BasicBlock::Create(*context, "entry", loop.task);
+    builder.SetInsertPoint(entry);
+    if(env_type) {
+        Value *env = builder.CreateBitCast(loop.task->getArg(2), env_type->getPointerTo());
+        for(size_t i = 0; i < captured.size(); i++) {
+            Value *value = builder.CreateLoad(fields[i], builder.CreateStructGEP(env_type, env, i), captured[i]);
+            AllocaInst *alloca = CreateEntryBlockAlloca(loop.task, captured[i], fields[i]);
+            builder.CreateStore(value, alloca);
+            symbols.insert(captured[i], alloca);
+
+            auto known = ranges.find(variables[i]);
+            if(known != ranges.end()) {
+                KnownRange copy = known->second;
+                ranges[alloca] = copy;
+            }
+        }
+    }
+
+    AllocaInst *index = CreateEntryBlockAlloca(loop.task, identifier, ty);
+    symbols.insert(identifier, index);
+    ranges[index] = {index_range, (int)ty->getIntegerBitWidth()};
+    loop.counter = CreateEntryBlockAlloca(loop.task, "par.i", i64);
+    builder.CreateStore(loop.task->getArg(0), loop.counter);
+
+    loop.cond = BasicBlock::Create(*context, "par.cond", loop.task);
+    BasicBlock *body = BasicBlock::Create(*context, "par.body", loop.task);
+    loop.exit = BasicBlock::Create(*context, "par.exit");
+    builder.CreateBr(loop.cond);
+
+    builder.SetInsertPoint(loop.cond);
+    Value *i = builder.CreateLoad(i64, loop.counter, "par.i");
+    builder.CreateCondBr(builder.CreateICmpSLT(i, loop.task->getArg(1)), body, loop.exit);
+
+    builder.SetInsertPoint(body);
+    builder.CreateStore(builder.CreateIntCast(i, ty, true), index);
+    return loop;
 }
 
-Value* TypeConversion(Value *expr, Type* ty, LLVMCompiler *compiler) {
-    std::string type_str;
-    llvm::raw_string_ostream rso(type_str);
-    expr->getType()->print(rso);
+void LLVMCompiler::end_par(ParLoop &loop) {
+    Type *i64 = builder.getInt64Ty();
+    if(builder.GetInsertBlock()->getTerminator() == 0) {
+        // below `hi`, so it can't overflow
+        Value *i = builder.CreateLoad(i64, loop.counter, "par.i");
+        builder.CreateStore(builder.CreateNSWAdd(i, builder.getInt64(1), "par.next"), loop.counter);
+        builder.CreateBr(loop.cond);
+    }
+    loop.task->getBasicBlockList().push_back(loop.exit);
+    builder.SetInsertPoint(loop.exit);
+    builder.CreateRetVoid();
+
+    std::swap(loop.caller_symbols.table, symbols.table);
+    builder.SetInsertPoint(loop.caller);
+    FunctionCallee parallel_for = module.getOrInsertFunction("be_parallel_for", builder.getVoidTy(),
+        i64, i64, loop.task->getType(), builder.getInt8PtrTy());
+    builder.CreateCall(parallel_for, {loop.lo, loop.hi, loop.task, loop.env});
+}
+
+/*
+`@memo` functions cache their results in the runtime. The generated body of
+`func` moves to an internal `<function>.memo.body`, and `func` itself becomes a
+wrapper that looks its arguments up in the table of `<function>.memo` and only
+calls the body on a miss, storing what it returns. Recursive calls in the body
+still go to `func`, so they are cached as well. The global is what
+`be_memo_lookup` and `be_memo_store` take, `{table, name, number of arguments}`,
+the runtime creates the table the first time it is used.
+*/
+void LLVMCompiler::memoize(Function *func) {
+    std::string name = func->getName().str();
+    debug_log(this, "DEBUG: memoizing " + name);
+    Type *i64 = builder.getInt64Ty();
+    PointerType *i8_ptr = builder.getInt8PtrTy();
+
+    Function *body = Function::Create(func->getFunctionType(), GlobalValue::InternalLinkage,
+        name + ".memo.body", &module);
+    set_target_attributes(body);
+    body->getBasicBlockList().splice(body->begin(), func->getBasicBlockList());
+    for(size_t i = 0; i < func->arg_size(); i++) {
+        func->getArg(i)->replaceAllUsesWith(body->getArg(i));
+        body->getArg(i)->setName(func->getArg(i)->getName());
+    }
 
-    std::string type_str2;
-    llvm::raw_string_ostream rso2(type_str2);
-    ty->print(rso2);
+    StructType *cache_type = StructType::get(*context, {i8_ptr, i8_ptr, i64});
+    GlobalVariable *function_name = builder.CreateGlobalString(name, name + ".memo.name", 0, &module);
+    Constant *fields[] = {
+        ConstantPointerNull::get(i8_ptr),
+        ConstantExpr::getPointerCast(function_name, i8_ptr),
+        ConstantInt::get(i64, func->arg_size())
+    };
+    GlobalVariable *cache = new GlobalVariable(module, cache_type, false, GlobalValue::InternalLinkage,
+        ConstantStruct::get(cache_type, fields), name + ".memo");
+
+    BasicBlock *entry = BasicBlock::Create(*context, "entry", func);
+    BasicBlock *hit = BasicBlock::Create(*context, "memo.hit", func);
+    BasicBlock *miss = BasicBlock::Create(*context, "memo.miss", func);
+    builder.SetInsertPoint(entry);
+
+    // the arguments, widened to 64 bits, are the key
+    ArrayType *key_type = ArrayType::get(i64, func->arg_size());
+    AllocaInst *key = builder.CreateAlloca(key_type, nullptr, "memo.key");
+    std::vector<Value*> args;
+    for(auto &arg : func->args()) {
+        args.push_back(&arg);
+        Value *slot = builder.CreateConstInBoundsGEP2_64(key_type, key, 0, arg.getArgNo());
+        builder.CreateStore(builder.CreateIntCast(&arg, i64, true), slot);
+    }
+    Value *key_ptr = builder.CreateConstInBoundsGEP2_64(key_type, key, 0, 0);
+    AllocaInst *cached = builder.CreateAlloca(i64, nullptr, "memo.value");
+    Value *cache_ptr = builder.CreateBitCast(cache, i8_ptr);
+
+    PointerType *i64_ptr = i64->getPointerTo();
+    FunctionCallee lookup = module.getOrInsertFunction("be_memo_lookup", builder.getInt32Ty(),
+        i8_ptr, i64_ptr, i64_ptr);
+    FunctionCallee store = module.getOrInsertFunction("be_memo_store", builder.getVoidTy(),
+        i8_ptr, i64_ptr, i64);
+    Value *found = builder.CreateCall(lookup, {cache_ptr, key_ptr, cached});
+    builder.CreateCondBr(builder.CreateICmpNE(found, builder.getInt32(0)), hit, miss);
+
+    // the value was stored from the same return type, so it fits
+    Type *ty = func->getReturnType();
+    builder.SetInsertPoint(hit);
+    builder.CreateRet(builder.CreateTrunc(builder.CreateLoad(i64, cached), ty));
+
+    builder.SetInsertPoint(miss);
+    Value *result = builder.CreateCall(body, args, "memo.result");
+    builder.CreateCall(store, {cache_ptr, key_ptr, builder.CreateIntCast(result, i64, true)});
+    builder.CreateRet(result);
+}
 
-    // std::cout<<rso.str()<<rso2.str()<<std::endl;
-    if(compiler->type_scope[rso2.str()] < compiler->type_scope[rso.str()]) {
+Value* TypeConversion(Value *expr, Type* ty, LLVMCompiler *compiler) {
+    // narrowing is fine when the value is known to fit
+    if(!range_fits(compiler->range(expr), ty->getIntegerBitWidth())) {
         std::cerr << "Error: Value bigger datatype than variable" << std::endl;
         exit(1);
     }
 
     return compiler->builder.CreateIntCast(expr, ty, true);
 }
+
+/*
+Both operands are widened to the wider of their widths and the operation wraps
+around in that width. When the range analysis shows it cannot overflow, it is
+done in the narrowest type the result fits in instead: that gives the same
+value, since add, sub and mul are also exact modulo the narrower width. A
+division is only narrowed when its operands fit as well.
+*/
+Value* CreateBinOp(int op, Value *left, Value *right, LLVMCompiler *compiler) {
+    IRBuilder<> &builder = compiler->builder;
+    Range left_range = compiler->range(left);
+    Range right_range = compiler->range(right);
+    int bits = std::max(compiler->value_bits(left), compiler->value_bits(right));
+
+    bool wraps;
+    Range range = range_binop(op, left_range, right_range, bits, wraps);
+    if(!wraps && range.lo == range.hi) {
+        // e.g. `x / 100000` for a short `x`, the operands are still evaluated
+        return ConstantInt::get(builder.getIntNTy(bits), range.lo, true);
+    }
+
+    int width = bits;
+    if(!wraps) {
+        width = range_bits(range);
+        if(op == NodeBinOp::DIV) {
+            width = std::max({width, range_bits(left_range), range_bits(right_range)});
+        }
+    }
+    Type *ty = builder.getIntNTy(width);
+    left = builder.CreateIntCast(left, ty, true);
+    right = builder.CreateIntCast(right, ty, true);
+
+    Value *result;
+    switch(op) {
+        case NodeBinOp::PLUS:
+            result = builder.CreateAdd(left, right, "addtmp");
+            break;
+        case NodeBinOp::MINUS:
+            result = builder.CreateSub(left, right, "minustmp");
+            break;
+        case NodeBinOp::MULT:
+            result = builder.CreateMul(left, right, "multmp");
+            break;
+        default:
+            result = builder.CreateSDiv(left, right, "divtmp");
+            break;
+    }
+    if(!isa<Constant>(result)) {
+        compiler->ranges[result] = {range, bits};
+    }
+    return result;
+}
+
+Range LLVMCompiler::range(Value *value) {
+    if(ConstantInt *constant = dyn_cast<ConstantInt>(value)) {
+        return {constant->getSExtValue(), constant->getSExtValue()};
+    }
+
+    // a variable is only stored to at its `let`, loading it gives what was stored
+    Value *key = value;
+    if(LoadInst *load = dyn_cast<LoadInst>(value)) {
+        key = load->getPointerOperand();
+    }
+    auto found = ranges.find(key);
+    if(found != ranges.end()) {
+        return found->second.range;
+    }
+    return full_range(value->getType()->getIntegerBitWidth());
+}
+
+// width the language gives `value`, see `KnownRange`
+int LLVMCompiler::value_bits(Value *value) {
+    auto found = ranges.find(value);
+    if(found != ranges.end()) {
+        return found->second.bits;
+    }
+    return value->getType()->getIntegerBitWidth();
+}
+
 AllocaInst *CreateEntryBlockAlloca(Function *TheFunction,
                                           StringRef VarName, Type *ty) {
   IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
@@ -108,6 +481,29 @@ Type* gType(std::string dtype, LLVMCompiler *compiler)  {
     return ty;
 }
 
+void LLVMCompiler::optimize(int level) {
+    if(level <= 0) {
+        return;
+    }
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassBuilder PB(target_machine);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    OptimizationLevel opt_level = level == 1 ? OptimizationLevel::O1
+        : level == 2 ? OptimizationLevel::O2 : OptimizationLevel::O3;
+    ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(opt_level);
+    MPM.run(module, MAM);
+}
+
 void LLVMCompiler::dump() {
     outs() << module;
 }
@@ -120,169 +516,215 @@ void LLVMCompiler::write(std::string file_name) {
     fout.close();
 }
 
-//  ┌―――――――――――――――――――――┐  //
-//  │ AST -> LLVM Codegen │  //
-// └―――――――――――――――――――――┘   //
-
-// codegen for statements
-Value *NodeStmts::llvm_codegen(LLVMCompiler *compiler) {
-    Value *last = nullptr;
-    for(auto node : list) {
-        last = node->llvm_codegen(compiler);
-    }
-    return last;
-}
+//  ┌―――――――――――――┐  //
+//  │ IR emission │  //
+// └―――――――――――――┘   //
 
-Value *NodeDebug::llvm_codegen(LLVMCompiler *compiler) {
-    Value *expr = expression->llvm_codegen(compiler);
-    Value *temp = compiler->builder.CreateIntCast(expr, compiler->builder.getInt64Ty(), true);
+Value *LLVMCompiler::emit_debug(Value *expr) {
+    Value *temp = builder.CreateIntCast(expr, builder.getInt64Ty(), true);
 
-    Function *printi_func = compiler->module.getFunction("printi");
-    compiler->builder.CreateCall(printi_func, {temp});
+    Function *printi_func = module.getFunction("printi");
+    builder.CreateCall(printi_func, {temp});
 
     return expr;
 }
 
-Value *NodeInt::llvm_codegen(LLVMCompiler *compiler) {
-    if(std::abs(value) <= 32767) {
-        return compiler->builder.getInt16(value);
+// a literal is as wide as its value needs, unless the parser gave it a type
+Value *LLVMCompiler::emit_int(long long value, std::string dtype) {
+    if(!dtype.empty()) {
+        return ConstantInt::get(gType(dtype, this), value, true);
     }
-    else if(std::abs(value) <= 2147483647){
-        return compiler->builder.getInt32(value);
-    }
-    else {
-        return compiler->builder.getInt64(value);
+    else if(std::abs(value) <= 32767) {
+        return builder.getInt16(value);
     }
-}
-
-Value *NodeBinOp::llvm_codegen(LLVMCompiler *compiler) {
-    Value *left_expr = left->llvm_codegen(compiler);
-    Value *right_expr = right->llvm_codegen(compiler);
-
-    std::string type_str1;
-    llvm::raw_string_ostream rso1(type_str1);
-    left_expr->getType()->print(rso1);
-
-    std::string type_str2;
-    llvm::raw_string_ostream rso2(type_str2);
-    right_expr->getType()->print(rso2);
-
-    Type *max;
-    if(compiler->type_scope[rso1.str()] > compiler->type_scope[rso2.str()]) {
-        max = left_expr->getType();
+    else if(std::abs(value) <= 2147483647){
+        return builder.getInt32(value);
     }
     else {
-        max = right_expr->getType();
-    }
-    switch(op) {
-        case PLUS:
-        return compiler->builder.CreateAdd(TypeConversion(left_expr, max, compiler), TypeConversion(right_expr, max, compiler), "addtmp");
-        case MINUS:
-        return compiler->builder.CreateSub(TypeConversion(left_expr, max, compiler), TypeConversion(right_expr, max, compiler), "minustmp");
-        case MULT:
-        return compiler->builder.CreateMul(TypeConversion(left_expr, max, compiler), TypeConversion(right_expr, max, compiler), "multmp");
-        case DIV:
-        return compiler->builder.CreateSDiv(TypeConversion(left_expr, max, compiler), TypeConversion(right_expr, max, compiler), "divtmp");
+        return builder.getInt64(value);
     }
 }
 
+Value *LLVMCompiler::emit_decl(std::string identifier, std::string dtype, Value *expr) {
+    Type *ty = gType(dtype, this);
 
-Value *NodeDecl::llvm_codegen(LLVMCompiler *compiler) {
-    Value *expr = expression->llvm_codegen(compiler);
-
-    Type *ty = gType(dtype, compiler);
-
-    std::cout<<"DEBUG: creating alloca for "<<identifier<<" of type "<<dtype<<std::endl;
-    Function *TheFunction = compiler->builder.GetInsertBlock()->getParent();
+    debug_log(this, "DEBUG: creating alloca for " + identifier + " of type " + dtype);
+    Function *TheFunction = builder.GetInsertBlock()->getParent();
     AllocaInst *alloc = CreateEntryBlockAlloca(TheFunction, identifier, ty);
+    symbols.insert(identifier, alloc);
 
-    // compiler->locals[identifier] = alloc;
-    compiler->symbols.insert(identifier, alloc);
-
-    // std::string type_str;
-    // llvm::raw_string_ostream rso(type_str);
-    // expr->getType()->print(rso);
-
-    // if(compiler->type_scope[dtype] < compiler->type_scope[rso.str()]) {
-    //     std::cerr << "Error: Value bigger datatype than assignment" << std::endl;
-    //     exit(1);
-    // }
+    Value *temp = TypeConversion(expr, ty, this);
+    ranges[alloc] = {range(expr), (int)ty->getIntegerBitWidth()};
 
-    Value *temp = TypeConversion(expr, ty, compiler);
-
-    return compiler->builder.CreateStore(temp, alloc);
+    return builder.CreateStore(temp, alloc);
 }
 
-Value *NodeIdent::llvm_codegen(LLVMCompiler *compiler) {
-    // AllocaInst *alloc = compiler->locals[identifier];
-    AllocaInst *alloc = compiler->symbols.find(identifier);
+Value *LLVMCompiler::emit_load(std::string identifier) {
+    AllocaInst *alloc = symbols.find(identifier);
 
     // if your LLVM_MAJOR_VERSION >= 14
-    return compiler->builder.CreateLoad(alloc->getAllocatedType(), alloc, identifier);
+    return builder.CreateLoad(alloc->getAllocatedType(), alloc, identifier);
 }
 
-Value *NodeFunc::llvm_codegen(LLVMCompiler *compiler) {
-    Type *ty = gType(dtype, compiler);
+Value *LLVMCompiler::emit_return(Value *expr) {
+    Function *f = module.getFunction(current_function.top());
+    Type *ty = f->getReturnType();
+    return builder.CreateRet(TypeConversion(expr, ty, this));
+}
 
-    std::vector<Type*> argsT;
-    for (auto i: arglist->list) {
-        argsT.push_back(gType(i->dtype, compiler));
+// the function called by a call with `num_args` arguments, which are converted to its argument types
+Function *LLVMCompiler::callee(std::string identifier, size_t num_args) {
+    Function *CalleeF = module.getFunction(identifier);
+
+    if(num_args != CalleeF->arg_size()) {
+        std::cerr<<"ERROR: Number of arguements does not match function"<<std::endl;
+        exit(1);
     }
-    FunctionType *main_func_type = FunctionType::get(
-        ty, argsT, false /* is vararg */
-    );
+    return CalleeF;
+}
 
-    Function *main_func = Function::Create(
-        main_func_type,
-        GlobalValue::ExternalLinkage,
-        identifier,
-        &(compiler->module)
-    );
+// starts the body of a function, with its arguments stored in variables
+Function *LLVMCompiler::begin_func(std::string identifier, std::string dtype, const std::vector<std::string> &arg_names,
+    const std::vector<std::string> &arg_dtypes, int attributes) {
+    // already declared when the functions are generated in parallel
+    Function *main_func = declare(identifier, dtype, arg_dtypes);
+    set_target_attributes(main_func);
+    if(attributes & NodeFunc::MULTIVERSION) {
+        main_func->addFnAttr("multiversion");
+    }
+    // the values of other functions may have been freed since, see `LLVMCompiler::ranges`
+    ranges.clear();
 
     // create main function block
     BasicBlock *main_func_entry_bb = BasicBlock::Create(
-        *(compiler->context),
+        *context,
         "entry",
         main_func
     );
 
     int cnt=0;
     for (auto &i: main_func->args()) {
-        i.setName(arglist->list[cnt++]->identifier);
+        i.setName(arg_names[cnt++]);
     }
     // move the builder to the start of the main function block
-    compiler->builder.SetInsertPoint(main_func_entry_bb);
+    builder.SetInsertPoint(main_func_entry_bb);
 
-    std::cout<<"DEBUG: allocation arg memory for "<<identifier<<std::endl;
+    debug_log(this, "DEBUG: allocation arg memory for " + identifier);
     cnt=0;
     for(auto &i: main_func->args()) {
-        AllocaInst *alloca = CreateEntryBlockAlloca(main_func, i.getName(), gType(arglist->list[cnt++]->dtype, compiler));
-        compiler->builder.CreateStore(&i, alloca);
-        // compiler->locals[std::string(i.getName())] = alloca;
-        compiler->symbols.insert(std::string(i.getName()), alloca);
+        AllocaInst *alloca = CreateEntryBlockAlloca(main_func, i.getName(), gType(arg_dtypes[cnt++], this));
+        builder.CreateStore(&i, alloca);
+        symbols.insert(std::string(i.getName()), alloca);
     }
 
-    std::cout<<"DEBUG: starting codegen for "<<identifier<<std::endl;
+    debug_log(this, "DEBUG: starting codegen for " + identifier);
+    current_function.push(identifier);
+    return main_func;
+}
 
-    compiler->current_function.push(identifier);
-    Value *r = stmtlist->llvm_codegen(compiler);
-    compiler->current_function.pop();
+void LLVMCompiler::end_func(Function *func, int attributes) {
+    current_function.pop();
+    ranges.clear();
     // return 0;
-    if(compiler->builder.GetInsertBlock()->getTerminator() == 0) {
-        compiler->builder.CreateRet(compiler->builder.CreateIntCast(compiler->builder.getInt32(0), ty, true));
+    if(builder.GetInsertBlock()->getTerminator() == 0) {
+        builder.CreateRet(builder.CreateIntCast(builder.getInt32(0), func->getReturnType(), true));
     }
-    // compiler->builder.CreateRet(compiler->builder.CreateIntCast(compiler->builder.getInt32(0), ty, true));
+    if(attributes & NodeFunc::MEMO) {
+        memoize(func);
+    }
+}
 
-    return r;
+// branches on `cond` and starts the then branch, in its own scope
+IfBlocks LLVMCompiler::begin_if(Value *cond) {
+    IfBlocks blocks;
+    // compared in its own width, widening it first would not change the result
+    cond = builder.CreateICmpNE(cond, ConstantInt::get(cond->getType(), 0), "ifcond");
+
+    blocks.func = builder.GetInsertBlock()->getParent();
+
+    BasicBlock *ThenBB = BasicBlock::Create(*context, "then", blocks.func);
+    blocks.else_bb = BasicBlock::Create(*context, "else");
+    blocks.merge_bb = BasicBlock::Create(*context, "ifcont");
+    builder.CreateCondBr(cond, ThenBB, blocks.else_bb);
+
+    symbols.scope();
+    builder.SetInsertPoint(ThenBB);
+    return blocks;
 }
 
-Value *NodeCall::llvm_codegen(LLVMCompiler *compiler) {
-    Function *CalleeF = compiler->module.getFunction(identifier);
+void LLVMCompiler::begin_else(IfBlocks &blocks) {
+    symbols.unscope();
+    if(builder.GetInsertBlock()->getTerminator() == 0) {
+        builder.CreateBr(blocks.merge_bb);
+    }
 
-    if(paramlist->list.size() != CalleeF->arg_size()) {
-        std::cerr<<"ERROR: Number of arguements does not match function"<<std::endl;
-        exit(1);
+    blocks.func->getBasicBlockList().push_back(blocks.else_bb);
+    symbols.scope();
+    builder.SetInsertPoint(blocks.else_bb);
+}
+
+void LLVMCompiler::end_if(IfBlocks &blocks) {
+    symbols.unscope();
+    if(builder.GetInsertBlock()->getTerminator() == 0) {
+        builder.CreateBr(blocks.merge_bb);
+    }
+
+    blocks.func->getBasicBlockList().push_back(blocks.merge_bb);
+    builder.SetInsertPoint(blocks.merge_bb);
+}
+
+//  ┌―――――――――――――――――――――┐  //
+//  │ AST -> LLVM Codegen │  //
+// └―――――――――――――――――――――┘   //
+
+// codegen for statements
+Value *NodeStmts::llvm_codegen(LLVMCompiler *compiler) {
+    // a block is its own scope, also when an `if` was folded into a bare block
+    compiler->symbols.scope();
+    Value *last = nullptr;
+    for(auto node : list) {
+        last = node->llvm_codegen(compiler);
     }
+    compiler->symbols.unscope();
+    return last;
+}
+
+Value *NodeDebug::llvm_codegen(LLVMCompiler *compiler) {
+    return compiler->emit_debug(expression->llvm_codegen(compiler));
+}
+
+Value *NodeInt::llvm_codegen(LLVMCompiler *compiler) {
+    return compiler->emit_int(value, dtype);
+}
+
+Value *NodeBinOp::llvm_codegen(LLVMCompiler *compiler) {
+    Value *left_expr = left->llvm_codegen(compiler);
+    Value *right_expr = right->llvm_codegen(compiler);
+    return CreateBinOp(op, left_expr, right_expr, compiler);
+}
+
+Value *NodeDecl::llvm_codegen(LLVMCompiler *compiler) {
+    return compiler->emit_decl(identifier, dtype, expression->llvm_codegen(compiler));
+}
+
+Value *NodeIdent::llvm_codegen(LLVMCompiler *compiler) {
+    return compiler->emit_load(identifier);
+}
+
+Value *NodeFunc::llvm_codegen(LLVMCompiler *compiler) {
+    std::vector<std::string> arg_names, arg_dtypes;
+    for(auto arg : arglist->list) {
+        arg_names.push_back(arg->identifier);
+        arg_dtypes.push_back(arg->dtype);
+    }
+    Function *main_func = compiler->begin_func(identifier, dtype, arg_names, arg_dtypes, attributes);
+    Value *r = stmtlist->llvm_codegen(compiler);
+    compiler->end_func(main_func, attributes);
+    return r;
+}
+
+Value *NodeCall::llvm_codegen(LLVMCompiler *compiler) {
+    Function *CalleeF = compiler->callee(identifier, paramlist->list.size());
     std::vector<Value*> params;
     int cnt = 0;
     for(auto &i: CalleeF->args()) {
@@ -292,10 +734,7 @@ Value *NodeCall::llvm_codegen(LLVMCompiler *compiler) {
 }
 
 Value *NodeReturn::llvm_codegen(LLVMCompiler *compiler) {
-    Value *expr = expression->llvm_codegen(compiler);
-    Function *f = compiler->module.getFunction(compiler->current_function.top());
-    Type *ty = f->getReturnType();
-    return compiler->builder.CreateRet(TypeConversion(expr, ty, compiler));
+    return compiler->emit_return(expression->llvm_codegen(compiler));
 }
 
 Value *NodeArgs::llvm_codegen(LLVMCompiler *compiler) {
@@ -318,64 +757,22 @@ Value *NodeIfExpr::llvm_codegen(LLVMCompiler *compiler)
         return nullptr;
     }
 
-    // CondV = compiler->builder.CreateFCmpONE(ConstantFP::get(*(compiler->context), APFloat(0.0)), ConstantFP::get(*(compiler->context), APFloat(0.0)), "ifcond");
-    CondV = compiler->builder.CreateICmpNE(TypeConversion(CondV, compiler->builder.getInt64Ty(), compiler), compiler->builder.getInt64(0), "ifcond");
-
-    Function *TheFunction = compiler->builder.GetInsertBlock()->getParent();
-
-    BasicBlock *ThenBB = BasicBlock::Create(*(compiler->context), "then", TheFunction );
-    BasicBlock *ElseBB = BasicBlock::Create(*(compiler->context), "else");
-    BasicBlock *MergeBB = BasicBlock::Create(*(compiler->context), "ifcont");
-
-    if(compiler->builder.GetInsertBlock()->getTerminator() == 0) {
-    }
-    compiler->builder.CreateCondBr(CondV, ThenBB, ElseBB);
-
-    compiler->symbols.scope();
-    compiler->builder.SetInsertPoint(ThenBB);
-
+    IfBlocks blocks = compiler->begin_if(CondV);
     Value *ThenV = Then->llvm_codegen(compiler);
-    compiler->symbols.unscope();
-
-    if (!ThenV)
-       {return nullptr;}
-
-    if(compiler->builder.GetInsertBlock()->getTerminator() == 0) {
-        compiler->builder.CreateBr(MergeBB);
-    }
-
-    ThenBB = compiler->builder.GetInsertBlock();
-
-    TheFunction->getBasicBlockList().push_back(ElseBB);
-
-    compiler->symbols.scope();
-    compiler->builder.SetInsertPoint(ElseBB);
-
-    Value *ElseV = Else->llvm_codegen(compiler);
-    if (!ElseV)
-        return nullptr;
-    compiler->symbols.unscope();
-
-
-
-    if(compiler->builder.GetInsertBlock()->getTerminator() == 0) {
-        compiler->builder.CreateBr(MergeBB);
-    }
-
-    ElseBB = compiler->builder.GetInsertBlock();
-
-    TheFunction->getBasicBlockList().push_back(MergeBB);
-
-    compiler->builder.SetInsertPoint(MergeBB);
-    // PHINode *PN = compiler->builder.CreatePHI(Type::getInt32Ty(*(compiler->context)), 2, "iftmp");
-
-
-    // PN->addIncoming(ThenV, ThenBB);
-    // PN->addIncoming(ElseV, ElseBB);
+    compiler->begin_else(blocks);
+    Else->llvm_codegen(compiler);
+    compiler->end_if(blocks);
     return ThenV;
+}
 
+Value *NodePar::llvm_codegen(LLVMCompiler *compiler) {
+    Value *lo_v = lo->llvm_codegen(compiler);
+    Value *hi_v = hi->llvm_codegen(compiler);
 
-
- }
-
-#undef MAIN_FUNC
\ No newline at end of file
+    std::vector<std::string> names;
+    collect_identifiers(body, names);
+    ParLoop loop = compiler->begin_par(identifier, dtype, lo_v, hi_v, names);
+    body->llvm_codegen(compiler);
+    compiler->end_par(loop);
+    return nullptr;
+}
@@ -1,19 +1,36 @@
+#include <algorithm>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <regex>
+#include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "ast.hh"
+#include "consteval.hh"
+#include "dce.hh"
+#include "flatast.hh"
+#include "headercache.hh"
 #include "llvmcodegen.hh"
 #include "parser.hh"
+#include "printer.hh"
+#include "scanner.hh"
+#include "serialize.hh"
+#include "stream.hh"
+#include "vm.hh"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
 
 extern FILE *yyin;
-extern int yylex();
-extern char *yytext;
 
 extern FILE *fooin;
 extern FILE *fooout;
@@ -22,6 +39,8 @@ extern char *footext;
 
 extern std::string key;
 extern std::unordered_map<std::string, std::string> map;
+extern void pre_push_file(FILE *file);
+extern void pre_pop_file();
 
 NodeStmts *final_values;
 
@@ -29,33 +48,127 @@ NodeStmts *final_values;
 #define ARG_OPTION_P 1
 #define ARG_OPTION_S 2
 #define ARG_OPTION_O 3
+#define ARG_OPTION_VM 4
+#define ARG_OPTION_EMIT_AST 5
+#define ARG_OPTION_LEXBENCH 6
+#define ARG_OPTION_ASTBENCH 7
+#define ARG_OPTION_PARSEBENCH 8
 #define ARG_FAIL -1
 
+// flags that change how the stages run, rather than where compilation stops
+struct Options {
+    std::string output;
+    bool load_ast = false;
+    int opt_level = 0;
+    int jobs = 1;
+    bool stream = false;
+    bool json_ast = false;
+    bool flat = false;
+    // CPU to generate code for, empty for LLVM's default
+    std::string cpu;
+    // runtime bitcode linked into the module, found next to the compiler by default
+    std::string runtime;
+    bool runtime_set = false;
+} options;
+
 int parse_arguments(int argc, char *argv[]) {
-    if (argc == 3 || argc == 4) {
-        if (strlen(argv[2]) == 2 && argv[2][0] == '-') {
-            if (argc == 3) {
-                switch (argv[2][1]) {
-                    case 'l':
-                        return ARG_OPTION_L;
-
-                    case 'p':
-                        return ARG_OPTION_P;
-
-                    case 's':
-                        return ARG_OPTION_S;
-                }
-            } else if (argv[2][1] == 'o') {
-                return ARG_OPTION_O;
+    int arg_option = ARG_FAIL;
+    for (int i = 2; i < argc; i++) {
+        std::string arg(argv[i]);
+        int stage = ARG_FAIL;
+
+        if (arg == "-load-ast") {
+            options.load_ast = true;
+            continue;
+        } else if (arg == "-scanner=simd" || arg == "-scanner=flex") {
+            use_fast_scanner = arg == "-scanner=simd";
+            continue;
+        } else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3') {
+            options.opt_level = arg[2] - '0';
+            continue;
+        } else if (arg == "-stream") {
+            options.stream = true;
+            continue;
+        } else if (arg == "-j" && i + 1 < argc) {
+            options.jobs = atoi(argv[++i]);
+            if (options.jobs <= 0) {
+                options.jobs = std::max(1u, std::thread::hardware_concurrency());
             }
+            continue;
+        } else if (arg == "-flat") {
+            options.flat = true;
+            continue;
+        } else if (arg.compare(0, 7, "-march=") == 0 || arg.compare(0, 6, "-mcpu=") == 0) {
+            options.cpu = arg.substr(arg.find('=') + 1);
+            continue;
+        } else if (arg.compare(0, 9, "-runtime=") == 0) {
+            options.runtime = arg.substr(9);
+            options.runtime_set = true;
+            continue;
+        } else if (arg == "-lexbench") {
+            stage = ARG_OPTION_LEXBENCH;
+        } else if (arg == "-astbench") {
+            stage = ARG_OPTION_ASTBENCH;
+        } else if (arg == "-parsebench") {
+            stage = ARG_OPTION_PARSEBENCH;
+        } else if (arg == "-l") {
+            stage = ARG_OPTION_L;
+        } else if (arg == "-p" || arg == "-p=json") {
+            stage = ARG_OPTION_P;
+            options.json_ast = arg == "-p=json";
+        } else if (arg == "-s") {
+            stage = ARG_OPTION_S;
+        } else if (arg == "-vm") {
+            stage = ARG_OPTION_VM;
+        } else if ((arg == "-o" || arg == "-emit-ast") && i + 1 < argc) {
+            stage = arg == "-o" ? ARG_OPTION_O : ARG_OPTION_EMIT_AST;
+            options.output = argv[++i];
+        }
+
+        // exactly one stage option
+        if (stage == ARG_FAIL || arg_option != ARG_FAIL) {
+            arg_option = ARG_FAIL;
+            break;
         }
+        arg_option = stage;
+    }
+
+    // there are no tokens to print in a serialized AST
+    if (options.load_ast && (arg_option == ARG_OPTION_L || arg_option == ARG_OPTION_LEXBENCH || arg_option == ARG_OPTION_ASTBENCH || arg_option == ARG_OPTION_PARSEBENCH)) {
+        arg_option = ARG_FAIL;
+    }
+    // functions are compiled as they are parsed, straight to LLVM
+    if (options.stream && (options.load_ast || options.flat || (arg_option != ARG_OPTION_S && arg_option != ARG_OPTION_O))) {
+        arg_option = ARG_FAIL;
+    }
+    if (arg_option != ARG_FAIL) {
+        return arg_option;
     }
 
     std::cerr << "Usage:\nEach of the following options halts the compilation process at the corresponding stage and prints the intermediate output:\n\n";
     std::cerr << "\t`./bin/base <file_name> -l`, to tokenize the input and print the token stream to stdout\n";
     std::cerr << "\t`./bin/base <file_name> -p`, to parse the input and print the abstract syntax tree (AST) to stdout\n";
+    std::cerr << "\t`./bin/base <file_name> -p=json`, to parse the input and print the AST as JSON to stdout\n";
+    std::cerr << "\t`./bin/base <file_name> -emit-ast <output>`, to parse the input and write the AST in binary form to <output>\n";
     std::cerr << "\t`./bin/base <file_name> -s`, to compile the file to LLVM assembly and print it to stdout\n";
     std::cerr << "\t`./bin/base <file_name> -o <output>`, to compile the file to LLVM bitcode and write to <output>\n";
+    std::cerr << "\nTo run the program on the bytecode interpreter instead of compiling it:\n\n";
+    std::cerr << "\t`./bin/base <file_name> -vm`, prints the `dbg` output and exits with the return value of `main`\n";
+    std::cerr << "\nTo compare the two scanners on the preprocessed input:\n\n";
+    std::cerr << "\t`./bin/base <file_name> -lexbench`, checks that both produce the same tokens and prints their throughput\n";
+    std::cerr << "\nTo time the parser alone, on tokens scanned beforehand:\n\n";
+    std::cerr << "\t`./bin/base <file_name> -parsebench`, prints the best time per token of a few runs\n";
+    std::cerr << "\nTo compare the pointer AST with the flat AST on the parsed input:\n\n";
+    std::cerr << "\t`./bin/base <file_name> -astbench`, checks that both generate the same IR and prints their memory use and speed\n";
+    std::cerr << "\nOther options:\n\n";
+    std::cerr << "\t`-scanner=simd`, tokenize with the vectorized scanner instead of the flex one (`-scanner=flex`, the default)\n";
+    std::cerr << "\t`-O0` to `-O3`, optimization level of the generated LLVM code (default `-O0`)\n";
+    std::cerr << "\t`-j <n>`, generate and optimize functions on <n> threads, 0 for one per core (default 1)\n";
+    std::cerr << "\t`-stream`, with `-s` or `-o`: compile each function as soon as it is parsed and free its AST, for very large inputs. Calls are not evaluated at compile time, unreachable functions are kept and `-j` is ignored\n";
+    std::cerr << "\t`-flat`, with `-s` or `-o`: generate code from the flat AST (32 bit indices, no virtual calls) instead of the pointer tree, `-j` is ignored\n";
+    std::cerr << "\t`-runtime=<file>`, link <file> as the runtime bitcode instead of `runtime.bc` next to the compiler, nothing if <file> is empty\n";
+    std::cerr << "\t`-march=<cpu>` or `-mcpu=<cpu>`, generate code for <cpu> (`native` for this machine), sets the target triple and data layout of the module\n";
+    std::cerr << "\t`-load-ast`, <file_name> is an AST written by `-emit-ast`, preprocessing and parsing are skipped\n";
     return ARG_FAIL;
 }
 
@@ -90,19 +203,102 @@ bool cycle_check(std::unordered_map<std::string, std::string> m) {
     return false;
 }
 
-void preprocess() {
+#define HEADER_CACHE_DIR ".becache"
+
+// directory of every file being preprocessed, innermost last
+std::vector<std::string> include_dirs;
+// headers are only ever expanded once per program
+std::set<std::string> included_headers;
+// files read by the headers being expanded, innermost last
+std::vector<std::vector<HeaderDep>*> header_deps;
+HeaderCache header_cache(HEADER_CACHE_DIR);
+
+void preprocess(std::string temp_name);
+
+std::string directory_of(std::string path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+// expands an `#include "path"` directive to the preprocessed header
+std::string include_header(std::string directive) {
+    size_t open = directive.find('"');
+    std::string path = directive.substr(open + 1, directive.rfind('"') - open - 1);
+    if (path[0] != '/') {
+        path = include_dirs.back() + "/" + path;
+    }
+
+    char real_path[PATH_MAX];
+    if (!realpath(path.c_str(), real_path)) {
+        std::cerr << "Error: could not find header " << path << std::endl;
+        exit(1);
+    }
+    path = real_path;
+    if (!included_headers.insert(path).second) {
+        return "";
+    }
+
+    std::string cache_key = HeaderCache::make_key(path, file_mtime(path), map, included_headers);
+    HeaderCacheEntry entry;
+    if (header_cache.lookup(cache_key, entry)) {
+        map = entry.macros;
+        for (auto &dep : entry.deps) {
+            included_headers.insert(dep.path);
+        }
+    } else {
+        entry.deps.push_back({path, file_mtime(path)});
+
+        // preprocess the header on its own, from the macros defined so far
+        std::string temp_name = "temp." + std::to_string(include_dirs.size());
+        std::ifstream ifile(path);
+        std::ofstream otemp(temp_name);
+        std::string line;
+        while (getline(ifile, line)) {
+            otemp << line << std::endl;
+        }
+        ifile.close();
+        otemp.close();
+
+        include_dirs.push_back(directory_of(path));
+        header_deps.push_back(&entry.deps);
+        pre_push_file(nullptr);
+
+        preprocess(temp_name);
+        std::ifstream itext(temp_name);
+        entry.text.assign(std::istreambuf_iterator<char>(itext), std::istreambuf_iterator<char>());
+        itext.close();
+
+        pre_pop_file();
+        header_deps.pop_back();
+        include_dirs.pop_back();
+        remove(temp_name.c_str());
+
+        entry.macros = map;
+        header_cache.store(cache_key, entry);
+    }
+
+    // the header including this one depends on everything it read
+    if (!header_deps.empty()) {
+        header_deps.back()->insert(header_deps.back()->end(), entry.deps.begin(), entry.deps.end());
+    }
+    return entry.text;
+}
+
+void preprocess(std::string temp_name) {
     // Actual Pre
     int count;
     int token;
-    std::string contents;
+    // each pass is written here and then replaces the temp file, so the
+    // text never has to be held in memory as a whole
+    std::string next_name = temp_name + ".next";
 
     // Run preprocessor until no more macros can be expanded
     // Preprocessor works on a "temp" file which is removed at the end
     do {
-        fooin = fopen("temp", "r");
+        fooin = fopen(temp_name.c_str(), "r");
+        std::ofstream onext(next_name);
         count = 0;
         token = 0;
-        contents = "";
 
         // Run lexer on program (macro replacing and comment removal)
         do {
@@ -112,7 +308,8 @@ void preprocess() {
             // Every time a macro is added, check for cycles
             if (token == 5 && cycle_check(map)) {
                 std::cerr << "Cycle detected in #def statements" << std::endl;
-                remove("temp");
+                remove(temp_name.c_str());
+                remove(next_name.c_str());
                 fclose(fooin);
                 exit(1);
             }
@@ -122,45 +319,38 @@ void preprocess() {
                 count++;
                 temp = map[temp];
             }
-            contents += temp;
+
+            // Headers come back fully preprocessed
+            if (token == 6) {
+                temp = include_header(temp);
+            }
+            onext << temp;
 
         } while (token != 0);
+        fclose(fooin);
 
-        std::ofstream otemp("temp");
-        otemp << contents;
-        otemp.close();
+        onext.close();
+        rename(next_name.c_str(), temp_name.c_str());
     } while (count > 0);
 
-    fooin = fopen("temp", "r");
-    contents = "";
+    fooin = fopen(temp_name.c_str(), "r");
+    std::ofstream onext(next_name);
     do {
         token = foolex();
-        std::string temp = footext;
         if (token != 1 && token != 2 && token != 5)
-            contents += temp;
+            onext << footext;
 
     } while (token != 0);
 
-    // Printing final preprocessed code
-    // std::cout << "PRE" << std::endl
-    //           << contents << std::endl;
-
     fclose(fooin);
 
-    std::ofstream ofile("temp");
-    ofile << contents;
-    ofile.close();
+    onext.close();
+    rename(next_name.c_str(), temp_name.c_str());
 }
 
-int main(int argc, char *argv[]) {
-    int arg_option = parse_arguments(argc, argv);
-    if (arg_option == ARG_FAIL) {
-        exit(1);
-    }
-
+// preprocesses and parses `file_name`, returns nullptr when only tokens were asked for
+NodeStmts *parse_file(std::string file_name, int arg_option) {
     // Copying main file to temp for preprocessing
-    std::string file_name(argv[1]);
-
     std::ifstream itemp(file_name);
     std::ofstream otemp("temp");
     std::string line;
@@ -170,7 +360,8 @@ int main(int argc, char *argv[]) {
     itemp.close();
     otemp.close();
 
-    preprocess();
+    include_dirs.push_back(directory_of(file_name));
+    preprocess("temp");
 
     // Main Lexer and Parser
     yyin = fopen("temp", "r");
@@ -185,10 +376,25 @@ int main(int argc, char *argv[]) {
                 break;
             }
 
-            std::cout << token_to_string(token, yytext) << "\n";
+            std::string lexeme = token == yy::parser::token::TINT_LIT ? std::to_string(token_int) : has_lexeme(token) ? token_lexeme.str() : "";
+            std::cout << token_to_string(token, lexeme.c_str()) << "\n";
         }
         fclose(yyin);
-        return 0;
+        return nullptr;
+    }
+
+    if (arg_option == ARG_OPTION_LEXBENCH) {
+        scanner_benchmark(yyin);
+        fclose(yyin);
+        remove("temp");
+        return nullptr;
+    }
+
+    if (arg_option == ARG_OPTION_PARSEBENCH) {
+        parser_benchmark();
+        fclose(yyin);
+        remove("temp");
+        return nullptr;
     }
 
     final_values = nullptr;
@@ -199,19 +405,128 @@ int main(int argc, char *argv[]) {
     fclose(yyin);
     remove("temp");
 
+    return final_values;
+}
+
+// `-p` and `-p=json`
+static void print_ast(NodeStmts *root, bool json) {
+    if (json) {
+        JsonPrinter printer(std::cout);
+        root->accept(printer);
+    } else {
+        SExprPrinter printer(std::cout);
+        root->accept(printer);
+    }
+    std::cout << std::endl;
+}
+
+// `bin/runtime.bc` when the compiler is `bin/base`
+static std::string runtime_path(const char *argv0) {
+    std::string executable = llvm::sys::fs::getMainExecutable(argv0, (void*)&runtime_path);
+    llvm::SmallString<128> path(llvm::sys::path::parent_path(executable));
+    llvm::sys::path::append(path, "runtime.bc");
+    if (!llvm::sys::fs::exists(path)) {
+        std::cerr << "Warning: " << path.str().str() << " not found, the runtime is left to the linker" << std::endl;
+        return "";
+    }
+    return path.str().str();
+}
+
+int main(int argc, char *argv[]) {
+    int arg_option = parse_arguments(argc, argv);
+    if (arg_option == ARG_FAIL) {
+        exit(1);
+    }
+    if (!options.runtime_set && (arg_option == ARG_OPTION_S || arg_option == ARG_OPTION_O)) {
+        options.runtime = runtime_path(argv[0]);
+    }
+
+    std::string file_name(argv[1]);
+    final_values = nullptr;
+
+    if (options.stream) {
+        llvm::LLVMContext context;
+        LLVMCompiler compiler(&context, "base");
+        if (!options.cpu.empty()) {
+            compiler.set_target(options.cpu);
+        }
+        compiler.runtime = options.runtime;
+        StreamCompiler stream(&compiler, arg_option == ARG_OPTION_S, options.opt_level);
+
+        top_level_function = [&](NodeFunc *func) { stream.function(func); };
+        stream.finish(parse_file(file_name, arg_option));
+        if (arg_option == ARG_OPTION_O) {
+            compiler.write(options.output);
+        }
+        return 0;
+    }
+
+    if (options.load_ast) {
+        // already preprocessed, parsed and optimized
+        final_values = read_ast(file_name);
+    } else {
+        final_values = parse_file(file_name, arg_option);
+        if (arg_option == ARG_OPTION_L || arg_option == ARG_OPTION_LEXBENCH || arg_option == ARG_OPTION_PARSEBENCH) {
+            return 0;
+        }
+        // on the tree as parsed, before anything is folded or removed
+        if (arg_option == ARG_OPTION_ASTBENCH) {
+            if (final_values) {
+                ast_benchmark(final_values);
+            }
+            return 0;
+        }
+        // the tree as parsed, like the baseline, not what the passes below make of it
+        if (arg_option == ARG_OPTION_P) {
+            if (final_values) {
+                print_ast(final_values, options.json_ast);
+            }
+            return 0;
+        }
+        if (final_values) {
+            check_memo(final_values);
+            evaluate_constant_calls(final_values);
+            eliminate_dead_code(final_values);
+        }
+    }
+
     if (final_values) {
+        // a loaded file holds the tree as it was optimized before it was written
         if (arg_option == ARG_OPTION_P) {
-            std::cout << final_values->to_string() << std::endl;
+            print_ast(final_values, options.json_ast);
+            return 0;
+        }
+
+        if (arg_option == ARG_OPTION_EMIT_AST) {
+            write_ast(final_values, options.output);
             return 0;
         }
 
+        if (arg_option == ARG_OPTION_VM) {
+            VMCompiler vm_compiler;
+            VMProgram program = vm_compiler.compile(final_values);
+            return vm_run(program);
+        }
+
         llvm::LLVMContext context;
         LLVMCompiler compiler(&context, "base");
-        compiler.compile(final_values);
+        if (!options.cpu.empty()) {
+            compiler.set_target(options.cpu);
+        }
+        compiler.runtime = options.runtime;
+        if (options.flat) {
+            FlatAst flat = flatten(final_values);
+            compiler.compile_flat(flat);
+            compiler.multiversion();
+            compiler.link_runtime();
+            compiler.optimize(options.opt_level);
+        } else {
+            compiler.compile_parallel(final_values, options.jobs, options.opt_level);
+        }
         if (arg_option == ARG_OPTION_S) {
             compiler.dump();
         } else {
-            compiler.write(std::string(argv[3]));
+            compiler.write(options.output);
         }
     } else {
         std::cerr << "empty program";
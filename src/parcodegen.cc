@@ -0,0 +1,136 @@
+#include "llvmcodegen.hh"
+#include "ast.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+// chunks per worker, so one slow chunk does not leave the other threads idle
+#define CODEGEN_CHUNKS_PER_JOB 4
+
+/*
+Every chunk of functions is generated into a module of its own, in its own
+LLVMContext, so workers never share LLVM state. A chunk's module declares all
+functions of the program, so calls across chunks resolve once the chunks are
+linked. The chunks are fixed by the function order and the number of jobs,
+which keeps the output the same from run to run: optimizing a chunk can only
+inline calls between functions of the same chunk.
+*/
+
+struct CodegenChunk {
+    size_t begin;
+    size_t end;
+    SmallVector<char, 0> bitcode;
+};
+
+static void generate_chunk(std::vector<NodeFunc*> &funcs, CodegenChunk &chunk, LLVMCompiler *parent, int opt_level) {
+    LLVMContext context;
+    LLVMCompiler compiler(&context, parent->module.getModuleIdentifier());
+    if(parent->target_machine) {
+        compiler.set_target(parent->target_cpu, parent->target_features);
+    }
+
+    compiler.declare_runtime();
+    for(auto func : funcs) {
+        compiler.declare(func);
+    }
+
+    compiler.symbols.scope();
+    for(size_t i = chunk.begin; i < chunk.end; i++) {
+        funcs[i]->llvm_codegen(&compiler);
+    }
+    compiler.multiversion();
+    // every chunk inlines its own copy, unused ones are dropped by the optimizer
+    if(opt_level > 0) {
+        compiler.runtime = parent->runtime;
+        compiler.link_runtime();
+    }
+    compiler.optimize(opt_level);
+
+    raw_svector_ostream out(chunk.bitcode);
+    WriteBitcodeToFile(compiler.module, out);
+}
+
+void LLVMCompiler::compile_parallel(NodeStmts *root, int jobs, int opt_level) {
+    std::vector<NodeFunc*> funcs;
+    for(auto node : root->list) {
+        NodeFunc *func = dynamic_cast<NodeFunc*>(node);
+        if(!func) {
+            // top level code outside of functions has no function of its own to go to
+            funcs.clear();
+            break;
+        }
+        funcs.push_back(func);
+    }
+    if(jobs <= 1 || funcs.size() <= 1) {
+        compile(root);
+        multiversion();
+        link_runtime();
+        optimize(opt_level);
+        return;
+    }
+
+    size_t num_chunks = std::min(funcs.size(), (size_t) jobs * CODEGEN_CHUNKS_PER_JOB);
+    std::vector<CodegenChunk> chunks(num_chunks);
+    for(size_t i = 0; i < num_chunks; i++) {
+        chunks[i].begin = funcs.size() * i / num_chunks;
+        chunks[i].end = funcs.size() * (i + 1) / num_chunks;
+    }
+
+    std::atomic<size_t> next_chunk(0);
+    std::string name = module.getModuleIdentifier();
+    std::vector<std::thread> workers;
+    for(int i = 0; i < std::min(jobs, (int) num_chunks); i++) {
+        workers.emplace_back([&]() {
+            for(size_t c; (c = next_chunk++) < num_chunks; ) {
+                generate_chunk(funcs, chunks[c], this, opt_level);
+            }
+        });
+    }
+    for(auto &worker : workers) {
+        worker.join();
+    }
+
+    // when optimizing, every chunk has linked in and internalized its own copy of
+    // the runtime, one more here would be left over with nothing calling it
+    bool chunks_linked_runtime = opt_level > 0;
+    if(!chunks_linked_runtime) {
+        declare_runtime();
+    }
+    Linker linker(module);
+    for(auto &chunk : chunks) {
+        MemoryBufferRef buffer(StringRef(chunk.bitcode.data(), chunk.bitcode.size()), name);
+        Expected<std::unique_ptr<Module>> chunk_module = parseBitcodeFile(buffer, *context);
+        if(!chunk_module) {
+            std::cerr << "Error: could not read generated module: " << toString(chunk_module.takeError()) << std::endl;
+            exit(1);
+        }
+        if(linker.linkInModule(std::move(*chunk_module))) {
+            std::cerr << "Error: could not link generated modules" << std::endl;
+            exit(1);
+        }
+        chunk.bitcode.clear();
+    }
+
+    // linking appends definitions as it goes, put them back in source order
+    for(auto func : funcs) {
+        Function *linked = module.getFunction(func->identifier);
+        if(linked) {
+            linked->removeFromParent();
+            module.getFunctionList().push_back(linked);
+        }
+    }
+    if(!chunks_linked_runtime) {
+        link_runtime();
+    }
+}
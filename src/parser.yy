@@ -1,4 +1,6 @@
-%define api.value.type { ParserValue }
+%require "3.2"
+%language "c++"
+%define api.value.type variant
 
 %code requires {
 #include <iostream>
@@ -10,33 +12,82 @@
 
 }
 
+%code provides {
+
+// parses `yyin` into `final_values`, 0 on success
+int yyparse();
+
+/**
+    Scans `yyin` once, then times parsing the recorded tokens a few times and
+    prints the best time per token. Scanning is left out, see `-lexbench`.
+*/
+void parser_benchmark();
+
+}
+
 %code {
 
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 
-extern int yylex();
-extern int yyparse();
+#include "scanner.hh"
 
 extern NodeStmts* final_values;
 
 SymbolTable symbol_table, func_table;
 
+std::function<void(NodeFunc*)> top_level_function;
+// number of `fun`s being parsed, nested in each other
+static int function_depth = 0;
+// number of `par` bodies being parsed, nested in each other
+static int par_depth = 0;
+
 int yyerror(std::string msg);
 
+// tokens replayed by `parser_benchmark` instead of scanning, when set
+static const std::vector<LexedToken> *replay = nullptr;
+static size_t replay_pos = 0;
+
+// what the parser calls, the scanners only return the token
+static int yylex(yy::parser::semantic_type *value) {
+    int token;
+    Lexeme lexeme;
+    long long number;
+    if(replay) {
+        const LexedToken &next = (*replay)[replay_pos++];
+        token = next.token;
+        lexeme = next.lexeme;
+        number = next.value;
+    } else {
+        token = yylex();
+        lexeme = token_lexeme;
+        number = token_int;
+    }
+    if(has_lexeme(token)) {
+        value->emplace<Lexeme>(lexeme);
+    } else if(token == yy::parser::token::TINT_LIT) {
+        value->emplace<long long>(number);
+    }
+    return token;
+}
+
 }
 
 %token TPLUS TDASH TSTAR TSLASH
-%token <lexeme> TINT_LIT TIDENT DTYPE
-%token TLET TDBG TFUN TRET
+%token <long long> TINT_LIT
+%token <Lexeme> TIDENT DTYPE TATTR
+%token TLET TDBG TFUN TRET TPAR
 %token TSCOL TLPAREN TRPAREN TLCURL TRCURL TEQUAL TCOMMA
 %token TQM TCOLON
 %token TIF TELSE 
 
-%type <node> Expr Stmt
-%type <arg> Arg
-%type <stmts> Program StmtList
-%type <args> ArgList
-%type <params> ParaList
+%type <Node*> Expr Stmt
+%type <NodeArg*> Arg
+%type <NodeStmts*> Program StmtList
+%type <NodeArgs*> ArgList
+%type <NodeParams*> ParaList
+%type <unsigned> Attributes FunKeyword
 
 
 
@@ -53,23 +104,32 @@ Program :
 
 StmtList :
          { $$ = new NodeStmts(); } 
-         | Stmt                
-         { $$ = new NodeStmts(); $$->push_back($1); }
 	     | StmtList Stmt 
-         { $$->push_back($2); }
+         { $$ = $1; if($2) $$->push_back($2); }
 	     ;
 
-Stmt : TFUN {symbol_table.scope();} TIDENT TLPAREN ArgList TRPAREN TCOLON DTYPE TLCURL StmtList TRCURL
+Stmt : FunKeyword {symbol_table.scope();} TIDENT
      {
         if(func_table.contains($3)) {
             // tried to redeclare function, so error
             yyerror("tried to redeclare function.\n");
-        } else {
-            func_table.insert($3);
-            $$ = new NodeFunc($3, $8 ,$10, $5);
         }
+        // declared before the body so that it can call itself
+        func_table.insert($3);
+        function_depth++;
+     }
+       TLPAREN ArgList TRPAREN TCOLON DTYPE TLCURL StmtList TRCURL
+     {
+        $$ = new NodeFunc($3, $9 ,$11, $6);
+        ((NodeFunc*) $$)->attributes = $1;
 
         symbol_table.unscope();
+
+        // handed over as soon as it is complete, it is not part of the program's tree
+        if(--function_depth == 0 && top_level_function) {
+            top_level_function((NodeFunc*) $$);
+            $$ = nullptr;
+        }
      }
      
      | TLET TIDENT TCOLON DTYPE TEQUAL Expr TSCOL
@@ -88,17 +148,42 @@ Stmt : TFUN {symbol_table.scope();} TIDENT TLPAREN ArgList TRPAREN TCOLON DTYPE
      }
      | TRET Expr TSCOL
      {
+        if(par_depth) {
+            // the body is a task of its own, there is no function to return from
+            yyerror("ret inside a par body.\n");
+        }
         $$ = new NodeReturn($2);
      }
+     | TPAR TIDENT TCOLON DTYPE TEQUAL Expr TCOMMA Expr TLCURL
+     {
+        if(!function_depth) {
+            yyerror("par outside of a function.\n");
+        }
+        // the bounds can't use the loop variable, so it is declared only now
+        symbol_table.scope();
+        symbol_table.insert($2);
+        par_depth++;
+     }
+       StmtList TRCURL
+     {
+        $$ = new NodePar($2, $4, $6, $8, $11);
+        par_depth--;
+        symbol_table.unscope();
+     }
      | TIF {symbol_table.scope();} Expr TLCURL StmtList TRCURL TELSE {symbol_table.unscope(); symbol_table.scope();} TLCURL StmtList TRCURL
      {
         if (typeid(*$3) == typeid(NodeInt)){
             std::cout << "Integer Found in IF" << std::endl;
             NodeInt* temp_3 = dynamic_cast<NodeInt*>($3);
-            if(temp_3->value != 0)
+            if(temp_3->value != 0) {
                 $$ = $5;
-            else
+                delete_ast($10);
+            }
+            else {
                 $$ = $10;
+                delete_ast($5);
+            }
+            delete $3;
         }
         else{
             $$ = new NodeIfExpr($3, $5, $10);
@@ -113,8 +198,32 @@ Stmt : TFUN {symbol_table.scope();} TIDENT TLPAREN ArgList TRPAREN TCOLON DTYPE
      }
      ;
 
+// `fun` and the attributes in front of it
+FunKeyword : TFUN
+           { $$ = 0; }
+           | Attributes TFUN
+           { $$ = $1; }
+           ;
+
+Attributes : TATTR
+           {
+              $$ = NodeFunc::attribute($1);
+              if(!$$) {
+                  yyerror("unknown attribute @" + $1.str() + ".\n");
+              }
+           }
+           | Attributes TATTR
+           {
+              unsigned attribute = NodeFunc::attribute($2);
+              if(!attribute) {
+                  yyerror("unknown attribute @" + $2.str() + ".\n");
+              }
+              $$ = $1 | attribute;
+           }
+           ;
+
 Expr : TINT_LIT               
-     { $$ = new NodeInt(stoll($1)); }
+     { $$ = new NodeInt($1); }
      | TIDENT
      { 
         if(symbol_table.contains($1))
@@ -124,10 +233,12 @@ Expr : TINT_LIT
      }
      | Expr TPLUS Expr
      { 
-        if (typeid(*$1) == typeid(NodeInt)){
+        if (typeid(*$1) == typeid(NodeInt) && typeid(*$3) == typeid(NodeInt)){
             NodeInt* temp_1 = dynamic_cast<NodeInt*>($1);
             NodeInt* temp_3 = dynamic_cast<NodeInt*>($3);
             $$ = new NodeInt(temp_1->value + temp_3->value);
+            delete $1;
+            delete $3;
         }
         else{
             $$ = new NodeBinOp(NodeBinOp::PLUS, $1, $3); 
@@ -136,10 +247,12 @@ Expr : TINT_LIT
      }
      | Expr TDASH Expr
      { 
-        if (typeid(*$1) == typeid(NodeInt)){
+        if (typeid(*$1) == typeid(NodeInt) && typeid(*$3) == typeid(NodeInt)){
             NodeInt* temp_1 = dynamic_cast<NodeInt*>($1);
             NodeInt* temp_3 = dynamic_cast<NodeInt*>($3);
             $$ = new NodeInt(temp_1->value - temp_3->value);
+            delete $1;
+            delete $3;
         }
         else{
             $$ = new NodeBinOp(NodeBinOp::MINUS, $1, $3); 
@@ -147,10 +260,12 @@ Expr : TINT_LIT
      }
      | Expr TSTAR Expr
      { 
-        if (typeid(*$1) == typeid(NodeInt)){
+        if (typeid(*$1) == typeid(NodeInt) && typeid(*$3) == typeid(NodeInt)){
             NodeInt* temp_1 = dynamic_cast<NodeInt*>($1);
             NodeInt* temp_3 = dynamic_cast<NodeInt*>($3);
             $$ = new NodeInt(temp_1->value * temp_3->value);
+            delete $1;
+            delete $3;
         }
         else{
             $$ = new NodeBinOp(NodeBinOp::MULT, $1, $3); 
@@ -158,10 +273,12 @@ Expr : TINT_LIT
      }
      | Expr TSLASH Expr
      { 
-        if (typeid(*$1) == typeid(NodeInt)){
+        if (typeid(*$1) == typeid(NodeInt) && typeid(*$3) == typeid(NodeInt)){
             NodeInt* temp_1 = dynamic_cast<NodeInt*>($1);
             NodeInt* temp_3 = dynamic_cast<NodeInt*>($3);
             $$ = new NodeInt(temp_1->value / temp_3->value);
+            delete $1;
+            delete $3;
         }
         else{
             $$ = new NodeBinOp(NodeBinOp::DIV, $1, $3); 
@@ -191,6 +308,7 @@ ArgList :
         |
           ArgList TCOMMA Arg
         {
+            $$ = $1;
             $$->push_back($3);
         }
         ;
@@ -220,6 +338,7 @@ ParaList :
         |
           ParaList TCOMMA Expr
         {
+            $$ = $1;
             $$->push_back($3);
         }
         ;
@@ -229,3 +348,48 @@ int yyerror(std::string msg) {
     std::cerr << "Error: Invalid Syntax " << msg << std::endl;
     exit(1);
 }
+
+void yy::parser::error(const std::string &msg) {
+    yyerror(msg);
+}
+
+int yyparse() {
+    yy::parser parser;
+    return parser.parse();
+}
+
+#define PARSER_BENCHMARK_RUNS 5
+
+void parser_benchmark() {
+    std::vector<LexedToken> tokens;
+    int token;
+    while((token = yylex()) != 0) {
+        tokens.push_back({token, has_lexeme(token) ? token_lexeme : Lexeme(), token == yy::parser::token::TINT_LIT ? token_int : 0});
+    }
+    tokens.push_back({0, Lexeme(), 0});
+
+    double best = 0;
+    for(int i = 0; i < PARSER_BENCHMARK_RUNS; i++) {
+        symbol_table = SymbolTable();
+        func_table = SymbolTable();
+        function_depth = 0;
+        par_depth = 0;
+        replay = &tokens;
+        replay_pos = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        yyparse();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if(i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+        replay = nullptr;
+        if(final_values) {
+            delete_ast(final_values);
+            final_values = nullptr;
+        }
+    }
+
+    printf("%zu tokens, scanned once up front\n", tokens.size() - 1);
+    printf("parse: %.2f ms  %.1f ns/token\n", best, best * 1e6 / (tokens.size() - 1));
+}
@@ -0,0 +1,284 @@
+#include "printer.hh"
+#include "ast.hh"
+
+#include <cstdio>
+
+//  ┌――――――――――――――┐  //
+//  │ S-expression │  //
+// └――――――――――――――┘   //
+
+void SExprPrinter::visit(NodeStmts *node) {
+    out << "(begin";
+    for(auto i : node->list) {
+        out << ' ';
+        i->accept(*this);
+    }
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeArg *node) {
+    out << '(' << node->dtype << ' ' << node->identifier << ')';
+}
+
+void SExprPrinter::visit(NodeArgs *node) {
+    out << '(';
+    for(auto i : node->list) {
+        out << ' ';
+        i->accept(*this);
+    }
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeParams *node) {
+    out << '(';
+    for(auto i : node->list) {
+        out << ' ';
+        i->accept(*this);
+    }
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeBinOp *node) {
+    out << '(';
+    switch(node->op) {
+        case NodeBinOp::PLUS: out << '+'; break;
+        case NodeBinOp::MINUS: out << '-'; break;
+        case NodeBinOp::MULT: out << '*'; break;
+        case NodeBinOp::DIV: out << '/'; break;
+    }
+    out << ' ';
+    node->left->accept(*this);
+    out << ' ';
+    node->right->accept(*this);
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeInt *node) {
+    out << node->value;
+}
+
+void SExprPrinter::visit(NodeDecl *node) {
+    out << "(let (" << node->identifier << ' ' << node->dtype << ") ";
+    node->expression->accept(*this);
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeDebug *node) {
+    out << "(dbg ";
+    node->expression->accept(*this);
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeIdent *node) {
+    out << node->identifier;
+}
+
+void SExprPrinter::visit(NodeFunc *node) {
+    out << "(fun " << node->dtype << ' ' << node->identifier;
+    for(auto &name : node->attribute_names()) {
+        out << " @" << name;
+    }
+    out << " args";
+    node->arglist->accept(*this);
+    out << " body";
+    node->stmtlist->accept(*this);
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeCall *node) {
+    out << "(call " << node->identifier << " (";
+    node->paramlist->accept(*this);
+    out << "))";
+}
+
+void SExprPrinter::visit(NodeReturn *node) {
+    out << "(ret ";
+    node->expression->accept(*this);
+    out << ')';
+}
+
+void SExprPrinter::visit(NodeIfExpr *node) {
+    out << "(if ";
+    node->Cond->accept(*this);
+    out << ' ';
+    node->Then->accept(*this);
+    out << ' ';
+    node->Else->accept(*this);
+    out << " )";
+}
+
+void SExprPrinter::visit(NodePar *node) {
+    out << "(par (" << node->identifier << ' ' << node->dtype << ") ";
+    node->lo->accept(*this);
+    out << ' ';
+    node->hi->accept(*this);
+    out << ' ';
+    node->body->accept(*this);
+    out << ')';
+}
+
+//  ┌――――――┐  //
+//  │ JSON │  //
+// └――――――┘   //
+
+void JsonPrinter::string(std::string s) {
+    out << '"';
+    for(char c : s) {
+        if(c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if((unsigned char) c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void JsonPrinter::list(std::vector<Node*> &nodes) {
+    out << '[';
+    for(size_t i = 0; i < nodes.size(); i++) {
+        if(i) {
+            out << ',';
+        }
+        nodes[i]->accept(*this);
+    }
+    out << ']';
+}
+
+void JsonPrinter::visit(NodeStmts *node) {
+    out << "{\"kind\":\"stmts\",\"body\":";
+    list(node->list);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeArg *node) {
+    out << "{\"name\":";
+    string(node->identifier);
+    out << ",\"type\":";
+    string(node->dtype);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeArgs *node) {
+    out << '[';
+    for(size_t i = 0; i < node->list.size(); i++) {
+        if(i) {
+            out << ',';
+        }
+        node->list[i]->accept(*this);
+    }
+    out << ']';
+}
+
+void JsonPrinter::visit(NodeParams *node) {
+    list(node->list);
+}
+
+void JsonPrinter::visit(NodeBinOp *node) {
+    out << "{\"kind\":\"binop\",\"op\":";
+    switch(node->op) {
+        case NodeBinOp::PLUS: out << "\"+\""; break;
+        case NodeBinOp::MINUS: out << "\"-\""; break;
+        case NodeBinOp::MULT: out << "\"*\""; break;
+        case NodeBinOp::DIV: out << "\"/\""; break;
+    }
+    out << ",\"left\":";
+    node->left->accept(*this);
+    out << ",\"right\":";
+    node->right->accept(*this);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeInt *node) {
+    out << "{\"kind\":\"int\",\"value\":" << node->value;
+    if(!node->dtype.empty()) {
+        out << ",\"type\":";
+        string(node->dtype);
+    }
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeDecl *node) {
+    out << "{\"kind\":\"let\",\"name\":";
+    string(node->identifier);
+    out << ",\"type\":";
+    string(node->dtype);
+    out << ",\"value\":";
+    node->expression->accept(*this);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeDebug *node) {
+    out << "{\"kind\":\"dbg\",\"value\":";
+    node->expression->accept(*this);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeIdent *node) {
+    out << "{\"kind\":\"ident\",\"name\":";
+    string(node->identifier);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeFunc *node) {
+    out << "{\"kind\":\"fun\",\"name\":";
+    string(node->identifier);
+    out << ",\"type\":";
+    string(node->dtype);
+    out << ",\"attributes\":[";
+    std::vector<std::string> names = node->attribute_names();
+    for(size_t i = 0; i < names.size(); i++) {
+        if(i > 0) {
+            out << ',';
+        }
+        string(names[i]);
+    }
+    out << "],\"args\":";
+    node->arglist->accept(*this);
+    out << ",\"body\":";
+    node->stmtlist->accept(*this);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeCall *node) {
+    out << "{\"kind\":\"call\",\"name\":";
+    string(node->identifier);
+    out << ",\"args\":";
+    node->paramlist->accept(*this);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeReturn *node) {
+    out << "{\"kind\":\"ret\",\"value\":";
+    node->expression->accept(*this);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodeIfExpr *node) {
+    out << "{\"kind\":\"if\",\"cond\":";
+    node->Cond->accept(*this);
+    out << ",\"then\":";
+    node->Then->accept(*this);
+    out << ",\"else\":";
+    node->Else->accept(*this);
+    out << '}';
+}
+
+void JsonPrinter::visit(NodePar *node) {
+    out << "{\"kind\":\"par\",\"name\":";
+    string(node->identifier);
+    out << ",\"type\":";
+    string(node->dtype);
+    out << ",\"lo\":";
+    node->lo->accept(*this);
+    out << ",\"hi\":";
+    node->hi->accept(*this);
+    out << ",\"body\":";
+    node->body->accept(*this);
+    out << '}';
+}
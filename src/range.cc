@@ -0,0 +1,98 @@
+#include "range.hh"
+#include "ast.hh"
+
+#include <cstdint>
+
+Range full_range(int bits) {
+    if(bits >= 64) {
+        return {INT64_MIN, INT64_MAX};
+    }
+    long long max = (1LL << (bits - 1)) - 1;
+    return {-max - 1, max};
+}
+
+bool range_fits(Range range, int bits) {
+    Range full = full_range(bits);
+    return range.lo >= full.lo && range.hi <= full.hi;
+}
+
+int range_bits(Range range) {
+    if(range_fits(range, 16)) {
+        return 16;
+    }
+    if(range_fits(range, 32)) {
+        return 32;
+    }
+    return 64;
+}
+
+Range range_binop(int op, Range left, Range right, int bits, bool &wraps) {
+    // the bounds of all four operations are at the corners, computed without
+    // overflow in 128 bits
+    __int128 lo = 0, hi = 0;
+    switch(op) {
+        case NodeBinOp::PLUS:
+            lo = (__int128)left.lo + right.lo;
+            hi = (__int128)left.hi + right.hi;
+            break;
+        case NodeBinOp::MINUS:
+            lo = (__int128)left.lo - right.hi;
+            hi = (__int128)left.hi - right.lo;
+            break;
+        case NodeBinOp::MULT: {
+            __int128 corners[] = {
+                (__int128)left.lo * right.lo, (__int128)left.lo * right.hi,
+                (__int128)left.hi * right.lo, (__int128)left.hi * right.hi
+            };
+            lo = hi = corners[0];
+            for(__int128 i : corners) {
+                lo = i < lo ? i : lo;
+                hi = i > hi ? i : hi;
+            }
+            break;
+        }
+        case NodeBinOp::DIV: {
+            // the quotient is monotonic in the divisor on either side of zero,
+            // so the divisors to try are the ends of the negative and the
+            // positive part of `right`
+            long long divisors[4];
+            int count = 0;
+            if(right.lo <= -1) {
+                divisors[count++] = right.lo;
+                divisors[count++] = right.hi < -1 ? right.hi : -1;
+            }
+            if(right.hi >= 1) {
+                divisors[count++] = right.lo > 1 ? right.lo : 1;
+                divisors[count++] = right.hi;
+            }
+            if(count == 0) {
+                wraps = true;
+                return full_range(bits);
+            }
+            lo = hi = (__int128)left.lo / divisors[0];
+            for(int i = 0; i < count; i++) {
+                for(long long dividend : {left.lo, left.hi}) {
+                    __int128 q = (__int128)dividend / divisors[i];
+                    lo = q < lo ? q : lo;
+                    hi = q > hi ? q : hi;
+                }
+            }
+            break;
+        }
+    }
+
+    Range full = full_range(bits);
+    wraps = lo < full.lo || hi > full.hi;
+    if(wraps) {
+        return full;
+    }
+    return {(long long)lo, (long long)hi};
+}
+
+Range range_index(Range lo, Range hi) {
+    // the body never runs, any range will do
+    if(hi.hi <= lo.lo) {
+        return {lo.lo, lo.lo};
+    }
+    return {lo.lo, hi.hi - 1};
+}
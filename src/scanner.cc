@@ -0,0 +1,439 @@
+#include "scanner.hh"
+#include "parser.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86
+#endif
+
+// the flex scanner, renamed with YY_DECL in src/lexer.lex
+extern int flex_lex();
+extern void yyrestart(FILE *file);
+extern FILE *yyin;
+extern int yyerror(std::string msg);
+
+// the vector loops read up to this many bytes past the end of the input
+#define SCANNER_PADDING 64
+
+#define KEYWORD_TABLE_SIZE 16
+
+typedef yy::parser::token Token;
+
+bool use_fast_scanner = false;
+
+Lexeme token_lexeme;
+long long token_int;
+
+//  ┌―――――――――┐  //
+//  │ Lexemes │  //
+// └―――――――――┘   //
+
+// bytes of a lexeme, in the scanner's buffer or in `lexeme_strings`
+struct LexemeKey {
+    const char *text;
+    size_t length;
+};
+
+struct LexemeKeyHash {
+    size_t operator()(const LexemeKey &key) const {
+        // FNV-1a
+        size_t hash = 14695981039346656037ull;
+        for(size_t i = 0; i < key.length; i++) {
+            hash = (hash ^ (unsigned char) key.text[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+struct LexemeKeyEqual {
+    bool operator()(const LexemeKey &a, const LexemeKey &b) const {
+        return a.length == b.length && memcmp(a.text, b.text, a.length) == 0;
+    }
+};
+
+// strings are never moved once in the deque, the map's keys point into them
+static std::deque<std::string> lexeme_strings;
+static std::unordered_map<LexemeKey, const std::string*, LexemeKeyHash, LexemeKeyEqual> lexeme_ids;
+
+Lexeme intern(const char *text, size_t length) {
+    auto found = lexeme_ids.find({text, length});
+    if(found != lexeme_ids.end()) {
+        return Lexeme(found->second);
+    }
+    lexeme_strings.emplace_back(text, length);
+    const std::string *interned = &lexeme_strings.back();
+    lexeme_ids.emplace(LexemeKey{interned->data(), interned->size()}, interned);
+    return Lexeme(interned);
+}
+
+long long int_literal(const char *text, size_t length) {
+    return std::stoll(std::string(text, length));
+}
+
+//  ┌――――――――――――――――――┐  //
+//  │ Character runs   │  //
+// └――――――――――――――――――┘   //
+
+// each returns the first byte at or after `p` that is not part of the run,
+// the zero padding after the input always ends a run
+
+static inline bool is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static inline bool is_digit(unsigned char c) {
+    return (unsigned char) (c - '0') < 10;
+}
+
+static inline bool is_letter(unsigned char c) {
+    return (unsigned char) ((c | 0x20) - 'a') < 26;
+}
+
+static const char *space_run_scalar(const char *p) {
+    while(is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char *digit_run_scalar(const char *p) {
+    while(is_digit(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char *letter_run_scalar(const char *p) {
+    while(is_letter(*p)) {
+        p++;
+    }
+    return p;
+}
+
+#ifdef __SSE2__
+static const char *space_run_sse2(const char *p) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(;;) {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        __m128i in_run = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+            _mm_cmpeq_epi8(v, newline));
+        unsigned stop = ~_mm_movemask_epi8(in_run) & 0xffff;
+        if(stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 16;
+    }
+}
+
+static const char *digit_run_sse2(const char *p) {
+    const __m128i below = _mm_set1_epi8('0' - 1);
+    const __m128i above = _mm_set1_epi8('9' + 1);
+    for(;;) {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        __m128i in_run = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+        unsigned stop = ~_mm_movemask_epi8(in_run) & 0xffff;
+        if(stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 16;
+    }
+}
+
+static const char *letter_run_sse2(const char *p) {
+    // setting bit 5 folds upper case onto lower case, bytes >= 0x80 compare
+    // as negative and never fall in the range
+    const __m128i fold = _mm_set1_epi8(0x20);
+    const __m128i below = _mm_set1_epi8('a' - 1);
+    const __m128i above = _mm_set1_epi8('z' + 1);
+    for(;;) {
+        __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i*) p), fold);
+        __m128i in_run = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+        unsigned stop = ~_mm_movemask_epi8(in_run) & 0xffff;
+        if(stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 16;
+    }
+}
+#endif
+
+#ifdef SCANNER_X86
+__attribute__((target("avx2")))
+static const char *space_run_avx2(const char *p) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for(;;) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        __m256i in_run = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)),
+            _mm256_cmpeq_epi8(v, newline));
+        unsigned stop = ~(unsigned) _mm256_movemask_epi8(in_run);
+        if(stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 32;
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *digit_run_avx2(const char *p) {
+    const __m256i below = _mm256_set1_epi8('0' - 1);
+    const __m256i above = _mm256_set1_epi8('9' + 1);
+    for(;;) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        __m256i in_run = _mm256_and_si256(_mm256_cmpgt_epi8(v, below), _mm256_cmpgt_epi8(above, v));
+        unsigned stop = ~(unsigned) _mm256_movemask_epi8(in_run);
+        if(stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 32;
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *letter_run_avx2(const char *p) {
+    const __m256i fold = _mm256_set1_epi8(0x20);
+    const __m256i below = _mm256_set1_epi8('a' - 1);
+    const __m256i above = _mm256_set1_epi8('z' + 1);
+    for(;;) {
+        __m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) p), fold);
+        __m256i in_run = _mm256_and_si256(_mm256_cmpgt_epi8(v, below), _mm256_cmpgt_epi8(above, v));
+        unsigned stop = ~(unsigned) _mm256_movemask_epi8(in_run);
+        if(stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 32;
+    }
+}
+#endif
+
+/**
+    The run functions best suited to the machine, picked once at startup.
+*/
+struct ScannerRuns {
+    const char *isa;
+    const char *(*space)(const char *p);
+    const char *(*digits)(const char *p);
+    const char *(*letters)(const char *p);
+};
+
+static ScannerRuns pick_runs() {
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return {"avx2", space_run_avx2, digit_run_avx2, letter_run_avx2};
+    }
+#endif
+#ifdef __SSE2__
+    return {"sse2", space_run_sse2, digit_run_sse2, letter_run_sse2};
+#else
+    return {"scalar", space_run_scalar, digit_run_scalar, letter_run_scalar};
+#endif
+}
+
+static ScannerRuns runs = pick_runs();
+
+const char *fast_scanner_isa() {
+    return runs.isa;
+}
+
+//  ┌――――――――――┐  //
+//  │ Keywords │  //
+// └――――――――――┘   //
+
+struct Keyword {
+    const char *word;
+    size_t length;
+    int token;
+};
+
+static const Keyword keywords[] = {
+    {"if", 2, Token::TIF}, {"else", 4, Token::TELSE}, {"dbg", 3, Token::TDBG}, {"let", 3, Token::TLET},
+    {"fun", 3, Token::TFUN}, {"ret", 3, Token::TRET}, {"int", 3, Token::DTYPE}, {"short", 5, Token::DTYPE},
+    {"long", 4, Token::DTYPE}, {"par", 3, Token::TPAR}
+};
+
+// collision free for the keywords above, recheck it when adding one
+static inline unsigned keyword_hash(const char *s, size_t length) {
+    return ((unsigned char) s[0] * 15 + (unsigned char) s[1] + length) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+static const Keyword *keyword_table[KEYWORD_TABLE_SIZE];
+
+static bool build_keyword_table() {
+    for(auto &keyword : keywords) {
+        keyword_table[keyword_hash(keyword.word, keyword.length)] = &keyword;
+    }
+    return true;
+}
+
+static bool keyword_table_built = build_keyword_table();
+
+// token for a run of letters, TIDENT unless it is exactly a keyword
+static inline int letters_token(const char *s, size_t length) {
+    if(length < 2 || length > 5) {
+        return Token::TIDENT;
+    }
+    const Keyword *keyword = keyword_table[keyword_hash(s, length)];
+    if(keyword && keyword->length == length && memcmp(keyword->word, s, length) == 0) {
+        return keyword->token;
+    }
+    return Token::TIDENT;
+}
+
+//  ┌―――――――――┐  //
+//  │ Scanner │  //
+// └―――――――――┘   //
+
+void FastScanner::load(FILE *file) {
+    buffer.clear();
+    char chunk[1 << 16];
+    size_t read;
+    while((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        buffer.insert(buffer.end(), chunk, chunk + read);
+    }
+    size_t size = buffer.size();
+    buffer.resize(size + SCANNER_PADDING, '\0');
+
+    pos = buffer.data();
+    end = pos + size;
+}
+
+int FastScanner::next(Lexeme &lexeme, long long &value) {
+    pos = runs.space(pos);
+    if(pos >= end) {
+        pos = end;
+        return 0;
+    }
+
+    const char *start = pos;
+    switch(*pos++) {
+        case '+': return Token::TPLUS;
+        case '-': return Token::TDASH;
+        case '*': return Token::TSTAR;
+        case '/': return Token::TSLASH;
+        case ';': return Token::TSCOL;
+        case ':': return Token::TCOLON;
+        case ',': return Token::TCOMMA;
+        case '(': return Token::TLPAREN;
+        case ')': return Token::TRPAREN;
+        case '{': return Token::TLCURL;
+        case '}': return Token::TRCURL;
+        case '=': return Token::TEQUAL;
+    }
+
+    if(is_digit(*start)) {
+        pos = runs.digits(pos);
+        value = int_literal(start, pos - start);
+        return Token::TINT_LIT;
+    }
+    if(is_letter(*start)) {
+        pos = runs.letters(pos);
+        int token = letters_token(start, pos - start);
+        // flex only sets the lexeme for these
+        if(token == Token::TIDENT || token == Token::DTYPE) {
+            lexeme = intern(start, pos - start);
+        }
+        return token;
+    }
+    if(*start == '@' && is_letter(*pos)) {
+        pos = runs.letters(pos);
+        lexeme = intern(start + 1, pos - start - 1);
+        return Token::TATTR;
+    }
+
+    yyerror("unknown char");
+    return 0;
+}
+
+static FastScanner fast_scanner;
+static bool fast_scanner_loaded = false;
+
+int yylex() {
+    if(!use_fast_scanner) {
+        return flex_lex();
+    }
+    if(!fast_scanner_loaded) {
+        fast_scanner.load(yyin);
+        fast_scanner_loaded = true;
+    }
+    return fast_scanner.next(token_lexeme, token_int);
+}
+
+//  ┌―――――――――――┐  //
+//  │ Benchmark │  //
+// └―――――――――――┘   //
+
+#define SCANNER_BENCHMARK_RUNS 5
+
+bool has_lexeme(int token) {
+    return token == Token::TIDENT || token == Token::DTYPE || token == Token::TATTR;
+}
+
+static int lex_once(FILE *file, bool fast, std::vector<LexedToken> *out) {
+    rewind(file);
+    yyin = file;
+    yyrestart(file);
+    if(fast) {
+        fast_scanner.load(file);
+    }
+
+    int count = 0;
+    int token;
+    while((token = fast ? fast_scanner.next(token_lexeme, token_int) : flex_lex()) != 0) {
+        count++;
+        if(out) {
+            LexedToken lexed = {token, has_lexeme(token) ? token_lexeme : Lexeme(), token == Token::TINT_LIT ? token_int : 0};
+            out->push_back(lexed);
+        }
+    }
+    return count;
+}
+
+// best time of a few runs, reading the input is included for both scanners
+static double time_scanner(FILE *file, bool fast) {
+    double best = 0;
+    for(int i = 0; i < SCANNER_BENCHMARK_RUNS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        lex_once(file, fast, nullptr);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if(i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+void scanner_benchmark(FILE *file) {
+    std::vector<LexedToken> flex_tokens, fast_tokens;
+    lex_once(file, false, &flex_tokens);
+    lex_once(file, true, &fast_tokens);
+
+    for(size_t i = 0; i < flex_tokens.size() || i < fast_tokens.size(); i++) {
+        if(i >= flex_tokens.size() || i >= fast_tokens.size() || flex_tokens[i] != fast_tokens[i]) {
+            std::cerr << "Error: scanners disagree at token " << i << std::endl;
+            exit(1);
+        }
+    }
+
+    double megabytes = (fast_scanner.end - fast_scanner.buffer.data()) / 1e6;
+    double flex_ms = time_scanner(file, false);
+    double fast_ms = time_scanner(file, true);
+
+    printf("input: %.2f MB, %zu tokens, token streams identical\n", megabytes, flex_tokens.size());
+    std::string fast_label = std::string("simd (") + runs.isa + ")";
+    printf("%-14s: %8.2f ms  %8.1f MB/s\n", "flex", flex_ms, megabytes / (flex_ms / 1000));
+    printf("%-14s: %8.2f ms  %8.1f MB/s\n", fast_label.c_str(), fast_ms, megabytes / (fast_ms / 1000));
+}
@@ -0,0 +1,395 @@
+#include "serialize.hh"
+#include "ast.hh"
+#include "visitor.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define AST_FILE_MAGIC "BEAS"
+
+// record tags, part of the file format so never renumber them
+enum AstTag {
+    TAG_STMTS = 1,
+    TAG_FUNC,
+    TAG_DECL,
+    TAG_DEBUG,
+    TAG_RETURN,
+    TAG_IF,
+    TAG_BINOP,
+    TAG_INT,
+    TAG_IDENT,
+    TAG_CALL,
+    TAG_PAR
+};
+
+//  ┌―――――――――┐  //
+//  │ Writing │  //
+// └―――――――――┘   //
+
+struct AstWriter : Visitor {
+    std::string records;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, unsigned long long> string_ids;
+
+    void varint(std::string &out, unsigned long long value);
+    void svarint(long long value);
+    void str(std::string s);
+
+    void visit(NodeStmts *node);
+    void visit(NodeArg *node);
+    void visit(NodeArgs *node);
+    void visit(NodeParams *node);
+    void visit(NodeBinOp *node);
+    void visit(NodeInt *node);
+    void visit(NodeDecl *node);
+    void visit(NodeDebug *node);
+    void visit(NodeIdent *node);
+    void visit(NodeFunc *node);
+    void visit(NodeCall *node);
+    void visit(NodeReturn *node);
+    void visit(NodeIfExpr *node);
+    void visit(NodePar *node);
+};
+
+void AstWriter::varint(std::string &out, unsigned long long value) {
+    while(value >= 0x80) {
+        out += (char) (value | 0x80);
+        value >>= 7;
+    }
+    out += (char) value;
+}
+
+void AstWriter::svarint(long long value) {
+    varint(records, ((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63));
+}
+
+void AstWriter::str(std::string s) {
+    auto found = string_ids.find(s);
+    if(found == string_ids.end()) {
+        found = string_ids.insert({s, strings.size()}).first;
+        strings.push_back(s);
+    }
+    varint(records, found->second);
+}
+
+void AstWriter::visit(NodeStmts *node) {
+    records += (char) TAG_STMTS;
+    varint(records, node->list.size());
+    for(auto i : node->list) {
+        i->accept(*this);
+    }
+}
+
+void AstWriter::visit(NodeFunc *node) {
+    records += (char) TAG_FUNC;
+    str(node->identifier);
+    str(node->dtype);
+    varint(records, node->attributes);
+    node->arglist->accept(*this);
+    node->stmtlist->accept(*this);
+}
+
+// the argument list of a function, part of its record
+void AstWriter::visit(NodeArgs *node) {
+    varint(records, node->list.size());
+    for(auto arg : node->list) {
+        arg->accept(*this);
+    }
+}
+
+void AstWriter::visit(NodeArg *node) {
+    str(node->identifier);
+    str(node->dtype);
+}
+
+void AstWriter::visit(NodeDecl *node) {
+    records += (char) TAG_DECL;
+    str(node->identifier);
+    str(node->dtype);
+    node->expression->accept(*this);
+}
+
+void AstWriter::visit(NodeDebug *node) {
+    records += (char) TAG_DEBUG;
+    node->expression->accept(*this);
+}
+
+void AstWriter::visit(NodeReturn *node) {
+    records += (char) TAG_RETURN;
+    node->expression->accept(*this);
+}
+
+void AstWriter::visit(NodeIfExpr *node) {
+    records += (char) TAG_IF;
+    node->Cond->accept(*this);
+    node->Then->accept(*this);
+    node->Else->accept(*this);
+}
+
+void AstWriter::visit(NodePar *node) {
+    records += (char) TAG_PAR;
+    str(node->identifier);
+    str(node->dtype);
+    node->lo->accept(*this);
+    node->hi->accept(*this);
+    node->body->accept(*this);
+}
+
+void AstWriter::visit(NodeBinOp *node) {
+    records += (char) TAG_BINOP;
+    records += (char) node->op;
+    node->left->accept(*this);
+    node->right->accept(*this);
+}
+
+void AstWriter::visit(NodeInt *node) {
+    records += (char) TAG_INT;
+    svarint(node->value);
+    str(node->dtype);
+}
+
+void AstWriter::visit(NodeIdent *node) {
+    records += (char) TAG_IDENT;
+    str(node->identifier);
+}
+
+void AstWriter::visit(NodeCall *node) {
+    records += (char) TAG_CALL;
+    str(node->identifier);
+    node->paramlist->accept(*this);
+}
+
+// the parameters of a call, part of its record
+void AstWriter::visit(NodeParams *node) {
+    varint(records, node->list.size());
+    for(auto i : node->list) {
+        i->accept(*this);
+    }
+}
+
+void write_ast(NodeStmts *root, std::string file_name) {
+    AstWriter writer;
+    root->accept(writer);
+
+    std::string header = AST_FILE_MAGIC;
+    for(int i = 0; i < 4; i++) {
+        header += (char) ((AST_FILE_VERSION >> (8 * i)) & 0xff);
+    }
+    writer.varint(header, writer.strings.size());
+    for(auto &s : writer.strings) {
+        writer.varint(header, s.size());
+        header += s;
+    }
+
+    std::ofstream fout(file_name, std::ios::binary);
+    fout << header << writer.records;
+    fout.close();
+    if(!fout) {
+        std::cerr << "Error: could not write " << file_name << std::endl;
+        exit(1);
+    }
+}
+
+//  ┌―――――――――┐  //
+//  │ Reading │  //
+// └―――――――――┘   //
+
+struct AstReader {
+    const unsigned char *pos;
+    const unsigned char *end;
+    std::vector<std::string> strings;
+    std::string file_name;
+
+    void corrupt();
+    unsigned long long varint();
+    long long svarint();
+    std::string str();
+    Node *node();
+    NodeStmts *stmts();
+};
+
+void AstReader::corrupt() {
+    std::cerr << "Error: corrupt AST file " << file_name << std::endl;
+    exit(1);
+}
+
+unsigned long long AstReader::varint() {
+    unsigned long long value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        if(pos == end) {
+            corrupt();
+        }
+        unsigned char byte = *pos++;
+        value |= (unsigned long long) (byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            return value;
+        }
+    }
+    corrupt();
+    return 0;
+}
+
+long long AstReader::svarint() {
+    unsigned long long value = varint();
+    return (long long) ((value >> 1) ^ (0ULL - (value & 1)));
+}
+
+std::string AstReader::str() {
+    unsigned long long id = varint();
+    if(id >= strings.size()) {
+        corrupt();
+    }
+    return strings[id];
+}
+
+NodeStmts *AstReader::stmts() {
+    NodeStmts *stmts = dynamic_cast<NodeStmts*>(node());
+    if(!stmts) {
+        corrupt();
+    }
+    return stmts;
+}
+
+Node *AstReader::node() {
+    if(pos == end) {
+        corrupt();
+    }
+
+    switch(*pos++) {
+        case TAG_STMTS: {
+            NodeStmts *stmts = new NodeStmts();
+            unsigned long long count = varint();
+            for(unsigned long long i = 0; i < count; i++) {
+                stmts->push_back(node());
+            }
+            return stmts;
+        }
+        case TAG_FUNC: {
+            std::string identifier = str();
+            std::string dtype = str();
+            unsigned attributes = varint();
+            NodeArgs *args = new NodeArgs();
+            unsigned long long count = varint();
+            for(unsigned long long i = 0; i < count; i++) {
+                std::string arg = str();
+                args->push_back(new NodeArg(arg, str()));
+            }
+            NodeFunc *func = new NodeFunc(identifier, dtype, stmts(), args);
+            func->attributes = attributes;
+            return func;
+        }
+        case TAG_DECL: {
+            std::string identifier = str();
+            std::string dtype = str();
+            return new NodeDecl(identifier, node(), dtype);
+        }
+        case TAG_DEBUG:
+            return new NodeDebug(node());
+        case TAG_RETURN:
+            return new NodeReturn(node());
+        case TAG_IF: {
+            Node *cond = node();
+            Node *then = node();
+            return new NodeIfExpr(cond, then, node());
+        }
+        case TAG_PAR: {
+            std::string identifier = str();
+            std::string dtype = str();
+            Node *lo = node();
+            Node *hi = node();
+            return new NodePar(identifier, dtype, lo, hi, stmts());
+        }
+        case TAG_BINOP: {
+            if(pos == end || *pos > NodeBinOp::DIV) {
+                corrupt();
+            }
+            NodeBinOp::Op op = (NodeBinOp::Op) *pos++;
+            Node *left = node();
+            return new NodeBinOp(op, left, node());
+        }
+        case TAG_INT: {
+            long long value = svarint();
+            return new NodeInt(value, str());
+        }
+        case TAG_IDENT:
+            return new NodeIdent(str());
+        case TAG_CALL: {
+            std::string identifier = str();
+            NodeParams *params = new NodeParams();
+            unsigned long long count = varint();
+            for(unsigned long long i = 0; i < count; i++) {
+                params->push_back(node());
+            }
+            return new NodeCall(identifier, params);
+        }
+    }
+    corrupt();
+    return nullptr;
+}
+
+NodeStmts *read_ast(std::string file_name) {
+    int fd = open(file_name.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        std::cerr << "Error: could not open " << file_name << std::endl;
+        exit(1);
+    }
+
+    size_t size = st.st_size;
+    if(size < 8) {
+        std::cerr << "Error: " << file_name << " is not an AST file" << std::endl;
+        exit(1);
+    }
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        std::cerr << "Error: could not map " << file_name << std::endl;
+        exit(1);
+    }
+
+    AstReader reader;
+    reader.file_name = file_name;
+    reader.pos = (const unsigned char*) data;
+    reader.end = reader.pos + size;
+
+    if(memcmp(reader.pos, AST_FILE_MAGIC, 4) != 0) {
+        std::cerr << "Error: " << file_name << " is not an AST file" << std::endl;
+        exit(1);
+    }
+    unsigned version = 0;
+    for(int i = 0; i < 4; i++) {
+        version |= (unsigned) reader.pos[4 + i] << (8 * i);
+    }
+    if(version != AST_FILE_VERSION) {
+        std::cerr << "Error: " << file_name << " was written by a different version of the compiler" << std::endl;
+        exit(1);
+    }
+    reader.pos += 8;
+
+    unsigned long long count = reader.varint();
+    for(unsigned long long i = 0; i < count; i++) {
+        unsigned long long length = reader.varint();
+        if(length > (unsigned long long) (reader.end - reader.pos)) {
+            reader.corrupt();
+        }
+        reader.strings.push_back(std::string((const char*) reader.pos, length));
+        reader.pos += length;
+    }
+
+    NodeStmts *root = reader.stmts();
+    if(reader.pos != reader.end) {
+        reader.corrupt();
+    }
+
+    munmap(data, size);
+    return root;
+}
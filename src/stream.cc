@@ -0,0 +1,239 @@
+#include "stream.hh"
+#include "ast.hh"
+#include "dce.hh"
+#include "visitor.hh"
+
+#include <algorithm>
+#include <iterator>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+#include <vector>
+
+StreamCompiler::StreamCompiler(LLVMCompiler *compiler, bool print_ir, int opt_level) :
+    compiler(compiler), print_ir(print_ir), opt_level(opt_level) {
+    PassBuilder PB(compiler->target_machine);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    if(opt_level > 0) {
+        OptimizationLevel level = opt_level == 1 ? OptimizationLevel::O1
+            : opt_level == 2 ? OptimizationLevel::O2 : OptimizationLevel::O3;
+        FPM = PB.buildFunctionSimplificationPipeline(level, ThinOrFullLTOPhase::None);
+    }
+
+    compiler->declare_runtime();
+    compiler->link_runtime();
+    compiler->symbols.scope();
+    for(auto &func : compiler->module) {
+        if(!func.isDeclaration()) {
+            runtime_functions.insert(&func);
+        }
+    }
+
+    if(print_ir) {
+        // what `Module::print` starts with, the runtime declarations included
+        Module &module = compiler->module;
+        outs() << "; ModuleID = '" << module.getModuleIdentifier() << "'\n";
+        outs() << "source_filename = \"" << module.getSourceFileName() << "\"\n";
+        if(!module.getDataLayoutStr().empty()) {
+            outs() << "target datalayout = \"" << module.getDataLayoutStr() << "\"\n";
+        }
+        if(!module.getTargetTriple().empty()) {
+            outs() << "target triple = \"" << module.getTargetTriple() << "\"\n";
+        }
+        if(!module.global_empty()) {
+            outs() << "\n";
+        }
+        for(auto &global : module.globals()) {
+            global.print(outs());
+            outs() << "\n";
+        }
+
+        std::vector<Function*> runtime;
+        for(auto &declared : module) {
+            runtime.push_back(&declared);
+        }
+        keep_attributes(runtime);
+        for(auto func : runtime) {
+            outs() << "\n";
+            func->print(outs());
+        }
+    }
+}
+
+/*
+Printing numbers attribute groups over the functions in the module at the time,
+and the printed functions are deleted afterwards. An unnamed declaration is kept
+for every attribute set that has been printed, in the order they were first
+seen, so that the numbers stay the same and `finish` can print the groups.
+*/
+void StreamCompiler::keep_attributes(const std::vector<Function*> &functions) {
+    std::vector<AttributeSet> sets;
+    for(auto &func : compiler->module) {
+        if(std::find(functions.begin(), functions.end(), &func) != functions.end()) {
+            sets.push_back(func.getAttributes().getFnAttrs());
+        }
+    }
+    // numbered after the ones on functions
+    for(auto func : functions) {
+        for(auto &block : *func) {
+            for(auto &instruction : block) {
+                if(CallBase *call = dyn_cast<CallBase>(&instruction)) {
+                    sets.push_back(call->getAttributes().getFnAttrs());
+                }
+            }
+        }
+    }
+
+    LLVMContext &context = *compiler->context;
+    for(auto set : sets) {
+        if(!set.hasAttributes() || std::find(attribute_sets.begin(), attribute_sets.end(), set) != attribute_sets.end()) {
+            continue;
+        }
+        attribute_sets.push_back(set);
+        Function *witness = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+            GlobalValue::ExternalLinkage, "", &compiler->module);
+        witness->setAttributes(AttributeList::get(context, set, AttributeSet(), {}));
+    }
+}
+
+void StreamCompiler::function(NodeFunc *func) {
+    // callees always come first, so purity is known for everything it calls
+    purity.add(func);
+    check_memo(func, &purity);
+    eliminate_dead_code(func, &purity);
+
+    Module &module = compiler->module;
+    std::vector<std::string> callees;
+    collect_calls(func->stmtlist, callees);
+    for(auto &callee : callees) {
+        auto signature = signatures.find(callee);
+        if(signature != signatures.end() && !module.getFunction(callee)) {
+            Function::Create(signature->second, GlobalValue::ExternalLinkage, callee, &module);
+        }
+    }
+
+    Function *last = &module.getFunctionList().back();
+    size_t globals = module.getGlobalList().size();
+    func->llvm_codegen(compiler);
+    Function *generated = module.getFunction(func->identifier);
+    signatures[func->identifier] = generated->getFunctionType();
+
+    // functions outlined from it, the bodies of its `par` loops and of a
+    // `@memo` function, and the runtime functions they call for the first time
+    std::vector<Function*> tasks;
+    std::vector<Function*> runtime;
+    for(auto f = ++last->getIterator(); f != module.end(); f++) {
+        if(&*f != generated) {
+            (f->isDeclaration() ? runtime : tasks).push_back(&*f);
+        }
+    }
+
+    // with `-o` the module is kept whole and multiversioned in `finish`
+    std::vector<Function*> versions;
+    bool had_cpu_level = module.getFunction("be_cpu_level");
+    if(print_ir && generated->hasFnAttribute("multiversion")) {
+        versions = compiler->multiversion(generated);
+    }
+    if(versions.empty()) {
+        versions.push_back(generated);
+    }
+    versions.insert(versions.end(), tasks.begin(), tasks.end());
+
+    for(auto version : versions) {
+        if(opt_level > 0) {
+            std::vector<CallBase*> calls;
+            for(auto &block : *version) {
+                for(auto &instruction : block) {
+                    CallBase *call = dyn_cast<CallBase>(&instruction);
+                    if(call && runtime_functions.count(call->getCalledFunction())) {
+                        calls.push_back(call);
+                    }
+                }
+            }
+            for(auto call : calls) {
+                InlineFunctionInfo info;
+                InlineFunction(*call, info);
+            }
+            FPM.run(*version, FAM);
+        }
+        FAM.clear(*version, version->getName());
+    }
+
+    if(print_ir) {
+        keep_attributes(versions);
+        Function *cpu_level = module.getFunction("be_cpu_level");
+        if(cpu_level && !had_cpu_level) {
+            outs() << "\n";
+            cpu_level->print(outs());
+        }
+        for(auto declared : runtime) {
+            outs() << "\n";
+            declared->print(outs());
+        }
+        // e.g. the cache of a `@memo` function, they stay in the module
+        auto global = module.global_begin();
+        std::advance(global, globals);
+        for(; global != module.global_end(); global++) {
+            outs() << "\n";
+            global->print(outs());
+            outs() << "\n";
+        }
+        GlobalIFunc *ifunc = module.getNamedIFunc(func->identifier);
+        if(ifunc) {
+            outs() << "\n";
+            ifunc->print(outs());
+            outs() << "\n";
+        }
+        for(auto version : versions) {
+            outs() << "\n";
+            version->print(outs());
+        }
+
+        // printing walks the whole module, keep it down to the runtime
+        if(ifunc) {
+            ifunc->eraseFromParent();
+        }
+        for(auto version : versions) {
+            version->deleteBody();
+        }
+        for(auto version : versions) {
+            if(version != generated) {
+                version->eraseFromParent();
+            }
+        }
+        for(auto f = module.begin(); f != module.end(); ) {
+            Function &declared = *f++;
+            if(signatures.count(declared.getName().str()) || &declared == generated) {
+                declared.eraseFromParent();
+            }
+        }
+    }
+    delete_ast(func);
+}
+
+// anything that was not in a function, as `LLVMCompiler::compile` would
+void StreamCompiler::finish(NodeStmts *rest) {
+    if(rest && !rest->list.empty()) {
+        rest->llvm_codegen(compiler);
+    }
+    if(!print_ir) {
+        compiler->multiversion();
+        // `be_cpu_level`, if something was multiversioned
+        compiler->link_runtime();
+        return;
+    }
+    // what `Module::print` ends with
+    if(!attribute_sets.empty()) {
+        outs() << "\n";
+    }
+    for(size_t i = 0; i < attribute_sets.size(); i++) {
+        outs() << "attributes #" << i << " = { " << attribute_sets[i].getAsString(true) << " }\n";
+    }
+}
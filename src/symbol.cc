@@ -1,8 +1,8 @@
 #include "symbol.hh"
 
-bool SymbolTable::contains(std::string key) {
+bool SymbolTable::contains(const std::string &key) {
     bool found = false;
-    for(auto i : table) {
+    for(auto &i : table) {
         if(i.find(key) != i.end()) {
             found = true;
             break;
@@ -11,11 +11,11 @@ bool SymbolTable::contains(std::string key) {
     return found;
 }
 
-bool SymbolTable::containsScope(std::string key) {
+bool SymbolTable::containsScope(const std::string &key) {
     return table.back().find(key) != table.back().end();
 }
 
-void SymbolTable::insert(std::string key) {
+void SymbolTable::insert(const std::string &key) {
     table.back().insert(key);
 }
 
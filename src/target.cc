@@ -0,0 +1,170 @@
+#include "llvmcodegen.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+/*
+`-march=`/`-mcpu=` give the module the host's triple and data layout, and
+every function the chosen CPU, so the optimizer and `llc` generate code for
+it instead of a generic x86-64.
+
+A function marked `@multiversion` is also cloned for the x86-64 levels below
+and becomes an ifunc, whose resolver picks the best clone for the CPU it runs
+on when the program is loaded. The resolver asks `be_cpu_level` in the runtime.
+*/
+
+static const char *multiversion_levels[] = {"x86-64-v2", "x86-64-v3", "x86-64-v4"};
+
+void LLVMCompiler::set_target(std::string cpu) {
+    std::string features;
+    if(cpu == "native") {
+        cpu = sys::getHostCPUName().str();
+
+        StringMap<bool> host_features;
+        if(sys::getHostCPUFeatures(host_features)) {
+            // sorted, so the attribute is the same from run to run
+            std::vector<std::string> names;
+            for(auto &feature : host_features) {
+                names.push_back(feature.first().str());
+            }
+            std::sort(names.begin(), names.end());
+
+            SubtargetFeatures list;
+            for(auto &name : names) {
+                list.AddFeature(name, host_features[name]);
+            }
+            features = list.getString();
+        }
+    }
+    set_target(cpu, features);
+}
+
+void LLVMCompiler::set_target(std::string cpu, std::string features) {
+    // the chunks of `-j` set their targets from several threads
+    static std::once_flag initialized;
+    std::call_once(initialized, []() { InitializeNativeTarget(); });
+
+    std::string triple = sys::getDefaultTargetTriple();
+    std::string error;
+    const Target *target = TargetRegistry::lookupTarget(triple, error);
+    if(!target) {
+        std::cerr << "Error: " << error << std::endl;
+        exit(1);
+    }
+
+    target_machine = target->createTargetMachine(triple, cpu, features, TargetOptions(), None);
+    if(!target_machine->getMCSubtargetInfo()->isCPUStringValid(cpu)) {
+        std::cerr << "Error: unknown CPU " << cpu << " for " << triple << std::endl;
+        exit(1);
+    }
+    target_cpu = cpu;
+    target_features = features;
+
+    module.setTargetTriple(triple);
+    module.setDataLayout(target_machine->createDataLayout());
+}
+
+void LLVMCompiler::set_target_attributes(Function *func) {
+    if(!target_machine) {
+        return;
+    }
+    func->addFnAttr("target-cpu", target_cpu);
+    if(!target_features.empty()) {
+        func->addFnAttr("target-features", target_features);
+    }
+}
+
+// clones every function marked `@multiversion`, run before `optimize`
+void LLVMCompiler::multiversion() {
+    std::vector<Function*> marked;
+    for(auto &func : module) {
+        if(func.hasFnAttribute("multiversion") && !func.isDeclaration()) {
+            marked.push_back(&func);
+        }
+    }
+    for(auto func : marked) {
+        multiversion(func);
+    }
+}
+
+/*
+Renames `func` to <name>.default and adds a clone for every level, all
+internal, and an ifunc <name> that every other use of `func` now goes through.
+Returns the versions, the default one first, followed by the resolver, or
+nothing when the target has no ifuncs.
+*/
+std::vector<Function*> LLVMCompiler::multiversion(Function *func) {
+    std::vector<Function*> versions;
+    func->removeFnAttr("multiversion");
+
+    std::string name = func->getName().str();
+    Triple triple(module.getTargetTriple().empty() ? sys::getDefaultTargetTriple() : module.getTargetTriple());
+    if(triple.getArch() != Triple::x86_64 || !triple.isOSBinFormatELF()) {
+        std::cerr << "Warning: @multiversion needs x86-64 ELF, " << name << " is generated once" << std::endl;
+        return versions;
+    }
+    if(name == "main") {
+        std::cerr << "Error: main cannot be @multiversion" << std::endl;
+        exit(1);
+    }
+
+    func->setName(name + ".default");
+    func->setLinkage(GlobalValue::InternalLinkage);
+    versions.push_back(func);
+
+    for(auto level : multiversion_levels) {
+        Function *clone = Function::Create(func->getFunctionType(), GlobalValue::InternalLinkage,
+            name + "." + level, &module);
+        ValueToValueMapTy map;
+        // a recursive call stays within its own version
+        map[func] = clone;
+        auto arg = clone->arg_begin();
+        for(auto &i : func->args()) {
+            arg->setName(i.getName());
+            map[&i] = &*arg++;
+        }
+        SmallVector<ReturnInst*, 4> returns;
+        CloneFunctionInto(clone, func, map, CloneFunctionChangeType::LocalChangesOnly, returns);
+
+        clone->removeFnAttr("target-features");
+        clone->addFnAttr("target-cpu", level);
+        versions.push_back(clone);
+    }
+
+    // picks the version for the `be_cpu_level()` of the machine it runs on
+    FunctionCallee cpu_level = module.getOrInsertFunction("be_cpu_level",
+        FunctionType::get(builder.getInt32Ty(), false));
+    Function *resolver = Function::Create(FunctionType::get(func->getType(), false),
+        GlobalValue::InternalLinkage, name + ".resolver", &module);
+    IRBuilder<> resolve(BasicBlock::Create(*context, "entry", resolver));
+    Value *level = resolve.CreateCall(cpu_level, {}, "level");
+    Value *chosen = func;
+    for(size_t i = 1; i < versions.size(); i++) {
+        Value *supported = resolve.CreateICmpSGE(level, resolve.getInt32(i + 1));
+        chosen = resolve.CreateSelect(supported, versions[i], chosen);
+    }
+    resolve.CreateRet(chosen);
+
+    GlobalIFunc *ifunc = GlobalIFunc::create(func->getFunctionType(), 0, GlobalValue::ExternalLinkage,
+        name, resolver, &module);
+    func->replaceUsesWithIf(ifunc, [&](Use &use) {
+        Instruction *user = dyn_cast<Instruction>(use.getUser());
+        return !user || (user->getFunction() != func && user->getFunction() != resolver);
+    });
+
+    versions.push_back(resolver);
+    return versions;
+}
@@ -0,0 +1,102 @@
+#include "visitor.hh"
+#include "ast.hh"
+
+#include <string>
+#include <vector>
+
+void Visitor::visit(NodeStmts *node) {
+    for(auto i : node->list) {
+        i->accept(*this);
+    }
+}
+
+void Visitor::visit(NodeArg *node) {}
+
+void Visitor::visit(NodeArgs *node) {
+    for(auto i : node->list) {
+        i->accept(*this);
+    }
+}
+
+void Visitor::visit(NodeParams *node) {
+    for(auto i : node->list) {
+        i->accept(*this);
+    }
+}
+
+void Visitor::visit(NodeBinOp *node) {
+    node->left->accept(*this);
+    node->right->accept(*this);
+}
+
+void Visitor::visit(NodeInt *node) {}
+
+void Visitor::visit(NodeDecl *node) {
+    node->expression->accept(*this);
+}
+
+void Visitor::visit(NodeDebug *node) {
+    node->expression->accept(*this);
+}
+
+void Visitor::visit(NodeIdent *node) {}
+
+void Visitor::visit(NodeFunc *node) {
+    node->arglist->accept(*this);
+    node->stmtlist->accept(*this);
+}
+
+void Visitor::visit(NodeCall *node) {
+    node->paramlist->accept(*this);
+}
+
+void Visitor::visit(NodeReturn *node) {
+    node->expression->accept(*this);
+}
+
+void Visitor::visit(NodeIfExpr *node) {
+    node->Cond->accept(*this);
+    node->Then->accept(*this);
+    node->Else->accept(*this);
+}
+
+void Visitor::visit(NodePar *node) {
+    node->lo->accept(*this);
+    node->hi->accept(*this);
+    node->body->accept(*this);
+}
+
+struct CallCollector : Visitor {
+    std::vector<std::string> &callees;
+
+    CallCollector(std::vector<std::string> &callees) : callees(callees) {}
+
+    using Visitor::visit;
+
+    void visit(NodeCall *node) {
+        callees.push_back(node->identifier);
+        Visitor::visit(node);
+    }
+};
+
+void collect_calls(Node *node, std::vector<std::string> &callees) {
+    CallCollector collector(callees);
+    node->accept(collector);
+}
+
+struct IdentifierCollector : Visitor {
+    std::vector<std::string> &names;
+
+    IdentifierCollector(std::vector<std::string> &names) : names(names) {}
+
+    using Visitor::visit;
+
+    void visit(NodeIdent *node) {
+        names.push_back(node->identifier);
+    }
+};
+
+void collect_identifiers(Node *node, std::vector<std::string> &names) {
+    IdentifierCollector collector(names);
+    node->accept(collector);
+}
@@ -0,0 +1,519 @@
+#include "vm.hh"
+#include "ast.hh"
+#include "consteval.hh"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+A register bytecode backend, used with `-vm` to run a program without going
+through LLVM. Every function gets a frame of `num_regs` registers on one shared
+register stack, arguments live in the first registers of the frame.
+*/
+
+//  ┌―――――――――――――――――――┐  //
+//  │ AST -> bytecode   │  //
+// └―――――――――――――――――――┘   //
+
+VMProgram VMCompiler::compile(NodeStmts *root) {
+    for(auto node : root->list) {
+        NodeFunc *func = dynamic_cast<NodeFunc*>(node);
+        if(!func) {
+            std::cerr << "Error: only functions can be run at the top level" << std::endl;
+            exit(1);
+        }
+        function_index[func->identifier] = program.functions.size();
+        function_nodes[func->identifier] = func;
+
+        VMFunction f;
+        f.name = func->identifier;
+        f.num_args = func->arglist->list.size();
+        f.num_regs = f.num_args;
+        f.memo = func->attributes & NodeFunc::MEMO;
+        program.functions.push_back(f);
+    }
+
+    if(function_index.find("main") == function_index.end()) {
+        std::cerr << "Error: no main function" << std::endl;
+        exit(1);
+    }
+    program.main_index = function_index["main"];
+
+    for(auto node : root->list) {
+        compile_function(dynamic_cast<NodeFunc*>(node));
+    }
+    return program;
+}
+
+void VMCompiler::compile_function(NodeFunc *func) {
+    current = &program.functions[function_index[func->identifier]];
+    return_bits = dtype_bits(func->dtype);
+    next_reg = current->num_args;
+
+    scopes.clear();
+    scopes.push_back(std::unordered_map<std::string, Slot>());
+    int cnt = 0;
+    for(auto arg : func->arglist->list) {
+        Slot slot = {cnt++, dtype_bits(arg->dtype), full_range(dtype_bits(arg->dtype))};
+        scopes.back()[arg->identifier] = slot;
+    }
+
+    compile_stmt(func->stmtlist);
+
+    // falling off the end returns 0
+    int zero = alloc_reg();
+    emit(OP_LOADI, zero, 0);
+    emit(OP_RET, zero);
+}
+
+void VMCompiler::compile_stmt(Node *node) {
+    int mark = next_reg;
+    declared = false;
+    node->accept(*this);
+
+    // temporaries die at the end of the statement
+    next_reg = declared ? mark + 1 : mark;
+    declared = false;
+}
+
+int VMCompiler::compile_expr(Node *node, int &bits, Range &range) {
+    result = -1;
+    node->accept(*this);
+    if(result < 0) {
+        std::cerr << "Error: cannot evaluate " << node->to_string() << std::endl;
+        exit(1);
+    }
+    bits = result_bits;
+    range = result_range;
+    return result;
+}
+
+void VMCompiler::visit(NodeStmts *node) {
+    scopes.push_back(std::unordered_map<std::string, Slot>());
+    for(auto i : node->list) {
+        compile_stmt(i);
+    }
+    scopes.pop_back();
+}
+
+void VMCompiler::visit(NodeDecl *node) {
+    // the variable keeps its register until the end of the block
+    int reg = alloc_reg();
+    int bits;
+    Range range;
+    int value = compile_expr(node->expression, bits, range);
+    check_width(range, bits, dtype_bits(node->dtype));
+    move_into(reg, value);
+
+    Slot slot = {reg, dtype_bits(node->dtype), range};
+    scopes.back()[node->identifier] = slot;
+    declared = true;
+}
+
+void VMCompiler::visit(NodeDebug *node) {
+    int bits;
+    Range range;
+    emit(OP_PRINT, compile_expr(node->expression, bits, range));
+}
+
+void VMCompiler::visit(NodeReturn *node) {
+    int bits;
+    Range range;
+    int value = compile_expr(node->expression, bits, range);
+    check_width(range, bits, return_bits);
+    emit(OP_RET, value);
+}
+
+void VMCompiler::visit(NodeIfExpr *node) {
+    int mark = next_reg;
+    int bits;
+    Range range;
+    int jump_else = emit(OP_JZ, compile_expr(node->Cond, bits, range), -1);
+    next_reg = mark;
+
+    compile_stmt(node->Then);
+    int jump_end = emit(OP_JMP, 0, -1);
+    current->code[jump_else].b = current->code.size();
+
+    compile_stmt(node->Else);
+    current->code[jump_end].b = current->code.size();
+}
+
+void VMCompiler::visit(NodePar *node) {
+    // the iterations simply run one after the other
+    int bits = dtype_bits(node->dtype);
+    int index = alloc_reg();
+    int hi = alloc_reg();
+    int one = alloc_reg();
+    int lo_bits, hi_bits;
+    Range lo_range, hi_range;
+    int value = compile_expr(node->lo, lo_bits, lo_range);
+    check_width(lo_range, lo_bits, bits);
+    move_into(index, value);
+    value = compile_expr(node->hi, hi_bits, hi_range);
+    check_width(hi_range, hi_bits, bits);
+    move_into(hi, value);
+    emit(OP_LOADI, one, 1);
+
+    int cond = alloc_reg();
+    int loop = emit(OP_LT, cond, index, hi);
+    int jump_end = emit(OP_JZ, cond, -1);
+    next_reg = cond;
+
+    Slot slot = {index, bits, range_index(lo_range, hi_range)};
+    scopes.push_back(std::unordered_map<std::string, Slot>());
+    scopes.back()[node->identifier] = slot;
+    compile_stmt(node->body);
+    scopes.pop_back();
+
+    emit(OP_ADD, index, index, one);
+    emit(OP_JMP, 0, loop);
+    current->code[jump_end].b = current->code.size();
+}
+
+void VMCompiler::visit(NodeFunc *node) {
+    std::cerr << "Error: nested functions are not supported" << std::endl;
+    exit(1);
+}
+
+void VMCompiler::visit(NodeInt *node) {
+    result_bits = literal_bits(node);
+    result_range = {node->value, node->value};
+    result = alloc_reg();
+    if(node->value >= INT32_MIN && node->value <= INT32_MAX) {
+        emit(OP_LOADI, result, node->value);
+    }
+    else {
+        program.constants.push_back(node->value);
+        emit(OP_LOADK, result, program.constants.size() - 1);
+    }
+}
+
+void VMCompiler::visit(NodeIdent *node) {
+    for(auto i = scopes.rbegin(); i != scopes.rend(); i++) {
+        auto found = i->find(node->identifier);
+        if(found != i->end()) {
+            result = found->second.reg;
+            result_bits = found->second.bits;
+            result_range = found->second.range;
+            return;
+        }
+    }
+    std::cerr << "Error: using undeclared variable " << node->identifier << std::endl;
+    exit(1);
+}
+
+void VMCompiler::visit(NodeBinOp *node) {
+    int lbits, rbits;
+    Range lrange, rrange;
+    int left = compile_expr(node->left, lbits, lrange);
+    int right = compile_expr(node->right, rbits, rrange);
+    int bits = lbits > rbits ? lbits : rbits;
+    bool wraps;
+    Range range = range_binop(node->op, lrange, rrange, bits, wraps);
+
+    VMOp op = OP_ADD;
+    switch(node->op) {
+        case NodeBinOp::PLUS: op = OP_ADD; break;
+        case NodeBinOp::MINUS: op = OP_SUB; break;
+        case NodeBinOp::MULT: op = OP_MUL; break;
+        case NodeBinOp::DIV: op = OP_DIV; break;
+    }
+    int reg = alloc_reg();
+    emit(op, reg, left, right);
+    // no need to wrap a result that cannot overflow
+    if(wraps && bits == 16) {
+        emit(OP_WRAP16, reg);
+    }
+    else if(wraps && bits == 32) {
+        emit(OP_WRAP32, reg);
+    }
+    result = reg;
+    result_bits = bits;
+    result_range = range;
+}
+
+void VMCompiler::visit(NodeCall *node) {
+    if(function_index.find(node->identifier) == function_index.end()) {
+        std::cerr << "Error: calling undeclared function " << node->identifier << std::endl;
+        exit(1);
+    }
+    NodeFunc *callee = function_nodes[node->identifier];
+    if(node->paramlist->list.size() != callee->arglist->list.size()) {
+        std::cerr << "ERROR: Number of arguements does not match function" << std::endl;
+        exit(1);
+    }
+
+    // arguments go to consecutive registers, reserved before evaluating them
+    int base = next_reg;
+    for(size_t i = 0; i < node->paramlist->list.size(); i++) {
+        alloc_reg();
+    }
+    for(size_t i = 0; i < node->paramlist->list.size(); i++) {
+        int pbits;
+        Range prange;
+        int value = compile_expr(node->paramlist->list[i], pbits, prange);
+        check_width(prange, pbits, dtype_bits(callee->arglist->list[i]->dtype));
+        move_into(base + i, value);
+    }
+
+    result_bits = dtype_bits(callee->dtype);
+    result_range = full_range(result_bits);
+    result = alloc_reg();
+    emit(OP_CALL, result, function_index[node->identifier], base);
+}
+
+int VMCompiler::alloc_reg() {
+    if(next_reg >= UINT16_MAX) {
+        std::cerr << "Error: function " << current->name << " needs too many registers" << std::endl;
+        exit(1);
+    }
+    if(next_reg + 1 > current->num_regs) {
+        current->num_regs = next_reg + 1;
+    }
+    return next_reg++;
+}
+
+int VMCompiler::emit(VMOp op, int a, int b, int c) {
+    VMInstr instr = {op, (uint16_t) a, b, c};
+    current->code.push_back(instr);
+    return current->code.size() - 1;
+}
+
+void VMCompiler::move_into(int dst, int src) {
+    if(dst == src) {
+        return;
+    }
+
+    // temporaries are always allocated after `dst`, let the instructions that
+    // just produced one write to `dst` directly instead of copying it over
+    std::vector<VMInstr> &code = current->code;
+    size_t i = code.size();
+    while(i > 0 && code[i - 1].a == src && (code[i - 1].op == OP_WRAP16 || code[i - 1].op == OP_WRAP32)) {
+        i--;
+    }
+    if(src > dst && i > 0 && code[i - 1].a == src && code[i - 1].op <= OP_DIV) {
+        for(; i - 1 < code.size(); i++) {
+            code[i - 1].a = dst;
+        }
+        return;
+    }
+    if(src > dst && i > 0 && code[i - 1].a == src && code[i - 1].op == OP_CALL) {
+        code[i - 1].a = dst;
+        return;
+    }
+    emit(OP_MOVE, dst, src);
+}
+
+// narrowing is fine when the value is known to fit, like `TypeConversion`
+void VMCompiler::check_width(Range range, int from, int to) {
+    if(to < from && !range_fits(range, to)) {
+        std::cerr << "Error: Value bigger datatype than variable" << std::endl;
+        exit(1);
+    }
+}
+
+//  ┌―――――――――――――┐  //
+//  │ Interpreter │  //
+// └―――――――――――――┘   //
+
+struct VMFrame {
+    const VMFunction *func;
+    const VMInstr *return_pc;
+    size_t base;
+    int dst;
+};
+
+// `@memo` results go in the same tables of runtime/runtime_lib.cc that compiled
+// programs use, so they are bounded by `BE_MEMO_SIZE` and counted for
+// `BE_MEMO_STATS` the same way. The layout of the `<function>.memo` global
+// codegen generates, see `LLVMCompiler::memoize`
+struct VMMemoCache {
+    void *table;
+    const char *name;
+    long long args;
+};
+
+extern "C" int be_memo_lookup(VMMemoCache *cache, const long long *key, long long *value);
+extern "C" void be_memo_store(VMMemoCache *cache, const long long *key, long long value);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_CASE(op) L_##op:
+#define VM_DISPATCH() goto *dispatch[pc->op]
+#else
+#define VM_CASE(op) case op:
+#define VM_DISPATCH() continue
+#endif
+
+long long vm_run(VMProgram &program) {
+    const VMFunction *func = &program.functions[program.main_index];
+    std::vector<long long> stack(func->num_regs + 256);
+    std::vector<VMFrame> frames;
+    const long long *constants = program.constants.data();
+
+    size_t base = 0;
+    long long *R = stack.data();
+    const VMInstr *pc = func->code.data();
+    // the memo table of every function, in function order. The runtime prints
+    // the name at exit, after the program is freed, so it is never freed
+    std::vector<VMMemoCache> memo(program.functions.size());
+    for(size_t i = 0; i < memo.size(); i++) {
+        memo[i] = {nullptr, strdup(program.functions[i].name.c_str()), program.functions[i].num_args};
+    }
+
+#ifdef VM_COMPUTED_GOTO
+    // same order as VMOp
+    static void *dispatch[OP_COUNT] = {
+        &&L_OP_LOADI, &&L_OP_LOADK, &&L_OP_MOVE, &&L_OP_ADD, &&L_OP_SUB,
+        &&L_OP_MUL, &&L_OP_DIV, &&L_OP_WRAP16, &&L_OP_WRAP32, &&L_OP_JZ,
+        &&L_OP_JMP, &&L_OP_CALL, &&L_OP_RET, &&L_OP_PRINT, &&L_OP_LT
+    };
+    VM_DISPATCH();
+#else
+    for(;;) switch(pc->op) {
+#endif
+
+    VM_CASE(OP_LOADI)
+        R[pc->a] = pc->b;
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_LOADK)
+        R[pc->a] = constants[pc->b];
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_MOVE)
+        R[pc->a] = R[pc->b];
+        pc++;
+        VM_DISPATCH();
+
+    // the unsigned casts make 64 bit overflow wrap instead of being undefined
+    VM_CASE(OP_ADD)
+        R[pc->a] = (long long) ((unsigned long long) R[pc->b] + (unsigned long long) R[pc->c]);
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_SUB)
+        R[pc->a] = (long long) ((unsigned long long) R[pc->b] - (unsigned long long) R[pc->c]);
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_MUL)
+        R[pc->a] = (long long) ((unsigned long long) R[pc->b] * (unsigned long long) R[pc->c]);
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_DIV)
+        if(R[pc->c] == 0) {
+            std::cerr << "Error: division by zero in " << func->name << std::endl;
+            exit(1);
+        }
+        else if(R[pc->c] == -1) {
+            R[pc->a] = (long long) (0ULL - (unsigned long long) R[pc->b]);
+        }
+        else {
+            R[pc->a] = R[pc->b] / R[pc->c];
+        }
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_WRAP16)
+        R[pc->a] = (int16_t) R[pc->a];
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_WRAP32)
+        R[pc->a] = (int32_t) R[pc->a];
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_JZ)
+        pc = R[pc->a] == 0 ? func->code.data() + pc->b : pc + 1;
+        VM_DISPATCH();
+
+    VM_CASE(OP_JMP)
+        pc = func->code.data() + pc->b;
+        VM_DISPATCH();
+
+    VM_CASE(OP_CALL) {
+        const VMFunction *callee = &program.functions[pc->b];
+        if(frames.size() >= VM_MAX_FRAMES) {
+            std::cerr << "Error: call stack overflow in " << callee->name << std::endl;
+            exit(1);
+        }
+
+        size_t callee_base = base + func->num_regs;
+        if(callee_base + callee->num_regs > stack.size()) {
+            stack.resize(2 * (callee_base + callee->num_regs));
+            R = stack.data() + base;
+        }
+        long long cached;
+        if(callee->memo && be_memo_lookup(&memo[pc->b], R + pc->c, &cached)) {
+            R[pc->a] = cached;
+            pc++;
+            VM_DISPATCH();
+        }
+        for(int i = 0; i < callee->num_args; i++) {
+            stack[callee_base + i] = R[pc->c + i];
+        }
+
+        VMFrame frame = {func, pc + 1, base, pc->a};
+        frames.push_back(frame);
+
+        func = callee;
+        base = callee_base;
+        R = stack.data() + base;
+        pc = func->code.data();
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_RET) {
+        long long value = R[pc->a];
+        if(frames.empty()) {
+            return value;
+        }
+        if(func->memo) {
+            // arguments are never assigned to, the first registers still hold them
+            be_memo_store(&memo[func - program.functions.data()], R, value);
+        }
+
+        VMFrame &frame = frames.back();
+        func = frame.func;
+        base = frame.base;
+        pc = frame.return_pc;
+        R = stack.data() + base;
+        R[frame.dst] = value;
+        frames.pop_back();
+        VM_DISPATCH();
+    }
+
+    VM_CASE(OP_PRINT)
+        // same output as printi in runtime/runtime_lib.cc
+        printf("%lld\n", R[pc->a]);
+        pc++;
+        VM_DISPATCH();
+
+    VM_CASE(OP_LT)
+        R[pc->a] = R[pc->b] < R[pc->c];
+        pc++;
+        VM_DISPATCH();
+
+#ifndef VM_COMPUTED_GOTO
+        default:
+            std::cerr << "Error: bad opcode " << pc->op << std::endl;
+            exit(1);
+    }
+#endif
+}
+
+#undef VM_CASE
+#undef VM_DISPATCH